@@ -1,17 +1,35 @@
 #include "archive.h"
+#include "extract_plan.h"
+#include "index_cache.h"
+#include "journal.h"
+#include "manifest.h"
 #include "libww/wwriff.h"
 #include "util.h"
+#include <algorithm>
 #include <fmt/core.h>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <sstream>
 #include <utility>
 
 namespace rdar {
 
 constexpr auto g_expected_magic = std::array<char, 4>{'R', 'D', 'A', 'R'};
-constexpr auto g_compression_magic = std::array<char, 4>{'K', 'A', 'R', 'K'};
 constexpr auto g_wem_magic = std::array<char, 4>{'R', 'I', 'F', 'F'};
 constexpr std::uint32_t g_expected_version = 12;
 
+constexpr std::size_t g_table_header_size = 28;
+constexpr std::size_t g_file_meta_size = 56;
+constexpr std::size_t g_offset_size = 16;
+constexpr std::size_t g_dependency_size = 8;
+
+// Creating and closing an output file costs about as much as writing this many bytes.
+constexpr std::uint64_t g_file_creation_cost = 64 * 1024;
+constexpr std::uint64_t g_extract_read_ahead = 32 * 1024 * 1024;
+// Smaller files are decoded on the calling thread.
+constexpr std::uint64_t g_parallel_decode_min_size = 1024 * 1024;
+
 void header::deserialize(rdar::reader &r) {
     std::array<char, 4> magic{};
     r.read_n(magic);
@@ -30,10 +48,6 @@ void header::deserialize(rdar::reader &r) {
     m_filesize = r.read<std::uint64_t>();
 }
 
-constexpr std::uint64_t header::table_offset() const {
-    return m_table_offset;
-}
-
 void file_meta::deserialize(reader &r) {
     m_hash = r.read<std::uint64_t>();
     m_time = r.read<std::uint64_t>();
@@ -49,7 +63,8 @@ void offset::deserialize(reader &r) {
     m_physical_size = r.read<std::uint32_t>();
     m_virtual_size = r.read<std::uint32_t>();
 }
-void table::deserialize(reader &r) {
+void table::deserialize(reader &r, std::uint64_t archive_size) {
+    m_archive_size = archive_size;
     m_number = r.read<std::uint32_t>();
     m_size = r.read<std::uint32_t>();
     m_checksum = r.read<std::uint64_t>();
@@ -57,139 +72,669 @@ void table::deserialize(reader &r) {
     m_num_offsets = r.read<std::uint32_t>();
     m_num_hashes = r.read<std::uint32_t>();
 
+    // Validate the counts against the region before allocating anything for them.
+    auto required = static_cast<std::uint64_t>(m_num_files) * g_file_meta_size +
+                    static_cast<std::uint64_t>(m_num_offsets) * g_offset_size +
+                    static_cast<std::uint64_t>(m_num_hashes) * g_dependency_size;
+    if (required > r.remaining()) {
+        throw std::runtime_error("archive table is truncated");
+    }
+
+    m_entry_section = r.read_span(m_num_files * g_file_meta_size);
+    m_offset_section = r.read_span(m_num_offsets * g_offset_size);
+    m_dependency_section = r.read_span(m_num_hashes * g_dependency_size);
+}
+
+void table::attach(const index_cache &cache, std::uint64_t archive_size) {
+    m_archive_size = archive_size;
+    m_checksum = cache.table_checksum();
+    m_file_entries = cache.entries();
+    m_offsets = cache.offsets();
+    m_hashes = cache.dependency_hashes();
+    m_num_files = static_cast<std::uint32_t>(m_file_entries.size());
+    m_num_offsets = static_cast<std::uint32_t>(m_offsets.size());
+    m_num_hashes = static_cast<std::uint32_t>(m_hashes.size());
+    m_index.assign(cache.index_hashes(), cache.index_positions(), cache.index_buckets(), cache.index_bucket_shift());
+    for (auto &meta : m_file_entries) {
+        check_entry(meta);
+    }
+    for (auto &off : m_offsets) {
+        check_offset(off);
+    }
+
+    // Everything is already decoded.
+    std::call_once(m_entries_decoded, [] {});
+    std::call_once(m_offsets_decoded, [] {});
+    std::call_once(m_dependencies_decoded, [] {});
+    m_has_entries = true;
+}
+
+void table::decode_entries() const {
+    reader r(m_entry_section);
+    m_entry_storage.resize(m_num_files);
+    std::vector<std::uint64_t> entry_hashes(m_num_files);
     for (std::size_t i = 0; i < m_num_files; ++i) {
-        file_meta entry;
+        auto &entry = m_entry_storage[i];
         entry.m_id = i;
         entry.deserialize(r);
-        m_file_entries[entry.m_hash] = entry;
+        check_entry(entry);
+        entry_hashes[i] = entry.m_hash;
     }
+    m_index.build(entry_hashes);
+    m_file_entries = m_entry_storage;
+    m_has_entries = true;
+}
 
-    m_offsets.resize(m_num_offsets);
-    std::generate_n(m_offsets.begin(), m_num_offsets, [&r]() {
+void table::decode_offsets() const {
+    reader r(m_offset_section);
+    m_offset_storage.resize(m_num_offsets);
+    std::generate_n(m_offset_storage.begin(), m_num_offsets, [this, &r]() {
         offset entry;
         entry.deserialize(r);
+        check_offset(entry);
         return entry;
     });
+    m_offsets = m_offset_storage;
+}
 
-    m_hashes.resize(m_num_hashes);
-    std::generate_n(m_hashes.begin(), m_num_hashes, [&r]() {
+void table::decode_dependencies() const {
+    reader r(m_dependency_section);
+    m_hash_storage.resize(m_num_hashes);
+    std::generate_n(m_hash_storage.begin(), m_num_hashes, [&r]() {
         return r.read<std::uint64_t>();
     });
+    m_hashes = m_hash_storage;
+}
+
+void table::check_entry(const file_meta &meta) const {
+    if (meta.m_first_sector > meta.m_last_sector || meta.m_last_sector > m_num_offsets) {
+        throw std::runtime_error("archive entry segments out of range");
+    }
+}
+
+void table::check_offset(const offset &off) const {
+    if (off.m_offset > m_archive_size || off.m_physical_size > m_archive_size - off.m_offset) {
+        throw std::runtime_error("archive segment out of range");
+    }
 }
 
-const std::unordered_map<std::uint64_t, file_meta> &table::file_entries() const {
+std::uint64_t table::checksum() const {
+    return m_checksum;
+}
+
+span<const file_meta> table::file_entries() const {
+    std::call_once(m_entries_decoded, [this] { decode_entries(); });
     return m_file_entries;
 }
 
-const std::vector<offset> &table::file_offsets() const {
+span<const offset> table::file_offsets() const {
+    std::call_once(m_offsets_decoded, [this] { decode_offsets(); });
     return m_offsets;
 }
 
-const offset &table::offset_at(std::uint32_t id) const {
-    return m_offsets[id];
+span<const std::uint64_t> table::dependency_hashes() const {
+    std::call_once(m_dependencies_decoded, [this] { decode_dependencies(); });
+    return m_hashes;
+}
+
+const file_index &table::index() const {
+    std::call_once(m_entries_decoded, [this] { decode_entries(); });
+    return m_index;
+}
+
+offset table::offset_at(std::uint32_t id) const {
+    if (id >= m_num_offsets) {
+        throw std::runtime_error("archive segment out of range");
+    }
+    if (m_offset_section.empty()) {
+        return m_offsets[id];
+    }
+
+    // A single offset is cheaper to decode in place than to materialize them all.
+    reader r(m_offset_section.subspan(static_cast<std::size_t>(id) * g_offset_size, g_offset_size));
+    offset result;
+    result.deserialize(r);
+    check_offset(result);
+    return result;
+}
+
+std::optional<file_meta> table::lookup(std::uint64_t hash) const {
+    if (m_has_entries) {
+        auto meta = find(hash);
+        if (meta == nullptr) {
+            return std::nullopt;
+        }
+        return *meta;
+    }
+
+    // Scanned back to front so that later duplicates win, as they do in the index.
+    for (auto i = m_num_files; i-- > 0;) {
+        auto raw_entry = m_entry_section.subspan(static_cast<std::size_t>(i) * g_file_meta_size, g_file_meta_size);
+        reader r(raw_entry);
+        if (r.read<std::uint64_t>() != hash) {
+            continue;
+        }
+
+        reader entry_reader(raw_entry);
+        file_meta meta;
+        meta.m_id = i;
+        meta.deserialize(entry_reader);
+        check_entry(meta);
+        return meta;
+    }
+    return std::nullopt;
+}
+
+file_meta table::entry_at(std::uint32_t position) const {
+    if (position >= m_num_files) {
+        throw std::out_of_range("file not found in archive");
+    }
+    if (m_has_entries) {
+        return m_file_entries[position];
+    }
+
+    reader r(m_entry_section.subspan(static_cast<std::size_t>(position) * g_file_meta_size, g_file_meta_size));
+    file_meta meta;
+    meta.m_id = position;
+    meta.deserialize(r);
+    check_entry(meta);
+    return meta;
 }
 
 const file_meta &table::meta_of(std::uint64_t hash) const {
-    return m_file_entries.at(hash);
+    auto meta = find(hash);
+    if (meta == nullptr) {
+        throw std::out_of_range("file not found in archive");
+    }
+    return *meta;
+}
+
+const file_meta *table::find(std::uint64_t hash) const {
+    auto position = index().find(hash);
+    if (position == file_index::npos) {
+        return nullptr;
+    }
+    return &m_file_entries[position];
+}
+
+std::vector<const file_meta *> table::find_many(span<const std::uint64_t> hashes) const {
+    std::vector<std::uint32_t> positions(hashes.size());
+    index().find_many(hashes, positions);
+
+    std::vector<const file_meta *> result(hashes.size());
+    std::transform(positions.begin(), positions.end(), result.begin(), [this](std::uint32_t position) {
+        return position == file_index::npos ? nullptr : &m_file_entries[position];
+    });
+    return result;
+}
+
+archive::archive(const mapped_file &file, std::string codebooks_file, const codec_registry &codecs) : m_file(file), m_data(file.data()), m_codebooks_file(std::move(codebooks_file)), m_codecs(codecs) {
+    reader r(m_data);
+    m_header.deserialize(r);
+
+    // The whole table region is read ahead once and decoded from a bounded view of it.
+    file.will_need(m_header.table_offset(), m_header.table_size());
+    r.seek(m_header.table_offset());
+    reader table_reader(r.read_span(m_header.table_size()));
+    m_table.deserialize(table_reader, m_data.size());
+}
+
+archive::archive(const mapped_file &file, const index_cache &cache, std::string codebooks_file, const codec_registry &codecs) : m_file(file), m_data(file.data()), m_codebooks_file(std::move(codebooks_file)), m_codecs(codecs), m_name_offsets(cache.name_offsets()), m_name_pool(cache.name_pool()) {
+    reader r(m_data);
+    m_header.deserialize(r);
+    m_table.attach(cache, m_data.size());
+}
+
+void archive::attach(segment_cache &cache) {
+    m_segment_cache = &cache;
+}
+
+void archive::attach(const dictionary &names) {
+    m_names = &names;
+}
+
+const table &archive::file_table() const {
+    return m_table;
 }
 
-archive::archive(std::istream &fs, std::unordered_map<std::uint64_t, std::string> hashes, std::string codebooks_file) : m_reader(fs), m_hashes(std::move(hashes)), m_codebooks_file(std::move(codebooks_file)) {
-    m_header.deserialize(m_reader);
-    m_reader.seek(m_header.table_offset());
-    m_table.deserialize(m_reader);
+bool archive::save_index(const std::string &path, const index_cache_key &key) const {
+    return index_cache::write(path, key, m_table, [this](const file_meta &meta) {
+        if (m_names == nullptr) {
+            return std::string();
+        }
+        return m_names->find(meta.m_hash).value_or(std::string());
+    });
 }
 
 std::string archive::make_filename(std::uint64_t hash) const {
-    auto at = m_hashes.find(hash);
-    if (at != m_hashes.end()) {
-        return at->second;
+    if (!m_name_offsets.empty()) {
+        auto meta = m_table.find(hash);
+        if (meta != nullptr) {
+            auto begin = m_name_offsets[meta->m_id];
+            auto end = m_name_offsets[meta->m_id + 1];
+            if (begin != end) {
+                return std::string(m_name_pool.data() + begin, end - begin);
+            }
+        }
+        return std::to_string(hash) + ".bin";
+    }
+
+    if (m_names != nullptr) {
+        if (auto name = m_names->find(hash)) {
+            return *name;
+        }
     }
     return std::to_string(hash) + ".bin";
 }
 
+std::vector<std::uint64_t> archive::unnamed_hashes() const {
+    std::vector<std::uint64_t> result;
+    for (auto &meta : m_table.file_entries()) {
+        auto named = !m_name_offsets.empty() ? m_name_offsets[meta.m_id] != m_name_offsets[meta.m_id + 1]
+                                             : m_names != nullptr && m_names->contains(meta.m_hash);
+        if (!named) {
+            result.push_back(meta.m_hash);
+        }
+    }
+    return result;
+}
+
 std::size_t archive::size_by_meta(const file_meta &meta) {
     std::uint64_t size = 0;
     for (std::size_t i = meta.m_first_sector; i < meta.m_last_sector; ++i) {
-        auto &off = m_table.offset_at(i);
-        size += off.m_physical_size;
+        auto off = m_table.offset_at(i);
+        size += off.m_virtual_size;
     }
     return size;
 }
 
 std::vector<file_parsed_info> archive::list_files() {
-    auto &entries = m_table.file_entries();
-    auto &offsets = m_table.file_offsets();
+    auto entries = m_table.file_entries();
 
     std::vector<file_parsed_info> result(entries.size());
-    std::transform(entries.begin(), entries.end(), result.begin(), [this, offsets](std::pair<std::uint64_t, file_meta> pair) {
-        auto m = pair.second;
+    std::transform(entries.begin(), entries.end(), result.begin(), [this](const file_meta &m) {
         return file_parsed_info{.name = make_filename(m.m_hash), .time = win_filetime_to_unix_ts(m.m_time), .size = size_by_meta(m), .hash = m.m_hash};
     });
 
     return result;
 }
 
-void archive::extract_file(std::ostream &out, std::uint64_t hash) {
-    auto &meta = m_table.meta_of(hash);
-    extract_file_by_meta(out, meta);
+void archive::extract_file(std::ostream &out, std::uint64_t hash, std::size_t decode_threads) {
+    auto meta = m_table.lookup(hash);
+    if (!meta) {
+        throw std::out_of_range("file not found in archive");
+    }
+    if (is_compressed(*meta)) {
+        auto data = decode_file(*meta, decode_threads);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        return;
+    }
+    extract_file_by_meta(out, *meta);
+}
+
+void archive::extract_file(int fd, std::uint64_t hash, std::size_t decode_threads) {
+    auto meta = m_table.lookup(hash);
+    if (!meta) {
+        throw std::out_of_range("file not found in archive");
+    }
+    extract_file(fd, *meta, decode_threads);
+}
+
+void archive::extract_file(int fd, const file_meta &meta, std::size_t decode_threads) {
+    if (is_compressed(meta)) {
+        auto data = decode_file(meta, decode_threads);
+        if (!write_all(fd, byte_span(data.data(), data.size()))) {
+            throw std::runtime_error("could not write file");
+        }
+        return;
+    }
+    for (auto &segment : segments_of(meta)) {
+        if (!m_file.write_to(fd, static_cast<std::uint64_t>(segment.data() - m_data.data()), segment.size())) {
+            throw std::runtime_error("could not write file");
+        }
+    }
 }
 
 bool archive::is_wem_file(const file_meta &meta) {
-    auto &off = m_table.offset_at(meta.m_first_sector);
-    if (off.m_physical_size != off.m_virtual_size)
+    if (meta.m_first_sector >= meta.m_last_sector)
         return false;
 
-    m_reader.seek(off.m_offset);
+    auto off = m_table.offset_at(meta.m_first_sector);
     std::array<char, 4> magic{};
-    m_reader.read_n(magic);
+    if (off.m_physical_size != off.m_virtual_size) {
+        if (off.m_virtual_size < magic.size()) {
+            return false;
+        }
+        auto segment = decoded_segment(meta.m_first_sector);
+        std::memcpy(magic.data(), segment->data(), magic.size());
+        return magic == g_wem_magic;
+    }
+
+    reader r(m_data);
+    r.seek(off.m_offset);
+    r.read_n(magic);
 
     return magic == g_wem_magic;
 }
 
 void archive::extract_file_by_meta(std::ostream &out, const file_meta &meta) {
+    if (is_compressed(meta)) {
+        auto data = decode_file(meta);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        return;
+    }
+    for (auto &segment : segments_of(meta)) {
+        out.write(segment.data(), static_cast<std::streamsize>(segment.size()));
+    }
+}
+
+bool archive::is_compressed(const file_meta &meta) {
     for (std::size_t i = meta.m_first_sector; i < meta.m_last_sector; ++i) {
-        auto &off = m_table.offset_at(i);
-        m_reader.seek(off.m_offset);
+        auto off = m_table.offset_at(i);
+        if (off.m_physical_size != off.m_virtual_size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<byte_span> archive::segments_of(const file_meta &meta) {
+    m_table.check_entry(meta);
+    // Physically contiguous segments are merged into a single view.
+    reader r(m_data);
+    std::vector<byte_span> result;
+    std::uint64_t run_end = 0;
+    for (std::size_t i = meta.m_first_sector; i < meta.m_last_sector; ++i) {
+        auto off = m_table.offset_at(i);
 
         if (off.m_physical_size != off.m_virtual_size) {
             throw std::runtime_error("compression not supported");
         }
 
-        m_reader.write_to(out, off.m_physical_size);
+        r.seek(off.m_offset);
+        auto segment = r.read_span(off.m_physical_size);
+        if (!result.empty() && off.m_offset == run_end) {
+            result.back() = byte_span(result.back().data(), result.back().size() + segment.size());
+        } else {
+            result.push_back(segment);
+        }
+        run_end = off.m_offset + off.m_physical_size;
+    }
+    return result;
+}
+
+std::string archive::decode_file(const file_meta &meta, std::size_t threads) {
+    // Checked here so that no worker is handed a segment out of range.
+    m_table.check_entry(meta);
+    std::vector<std::uint64_t> positions;
+    std::vector<std::uint64_t> costs;
+    std::uint64_t size = 0;
+    for (std::size_t i = meta.m_first_sector; i < meta.m_last_sector; ++i) {
+        auto off = m_table.offset_at(i);
+        positions.push_back(size);
+        costs.push_back(off.m_virtual_size);
+        size += off.m_virtual_size;
+    }
+
+    std::string result(size, '\0');
+    auto decode = [this, &meta, &positions, &costs, &result](std::size_t, std::size_t i) {
+        decode_segment(meta.m_first_sector + i, span<char>(result.data() + positions[i], costs[i]));
+    };
+    if (size < g_parallel_decode_min_size) {
+        threads = 1;
+    }
+    thread_pool(std::min(threads, costs.size())).run(costs, decode);
+    return result;
+}
+
+void archive::decode_segment(std::size_t index, span<char> out) {
+    auto off = m_table.offset_at(index);
+    reader r(m_data);
+    r.seek(off.m_offset);
+    auto segment = r.read_span(off.m_physical_size);
+    if (off.m_physical_size == off.m_virtual_size) {
+        std::memcpy(out.data(), segment.data(), segment.size());
+        return;
+    }
+    if (m_segment_cache == nullptr) {
+        m_codecs.decode(segment, out);
+        return;
+    }
+    auto decoded = decoded_segment(index);
+    if (decoded->size() != out.size()) {
+        throw std::runtime_error("decoded segment size mismatch");
+    }
+    std::memcpy(out.data(), decoded->data(), decoded->size());
+}
+
+segment_cache::buffer archive::decoded_segment(std::size_t index) {
+    if (m_segment_cache != nullptr) {
+        if (auto cached = m_segment_cache->find(index)) {
+            return cached;
+        }
+    }
+
+    auto off = m_table.offset_at(index);
+    reader r(m_data);
+    r.seek(off.m_offset);
+    auto decoded = std::make_shared<std::string>(off.m_virtual_size, '\0');
+    m_codecs.decode(r.read_span(off.m_physical_size), span<char>(decoded->data(), decoded->size()));
+
+    if (m_segment_cache != nullptr) {
+        m_segment_cache->insert(index, decoded);
+    }
+    return decoded;
+}
+
+void archive::run_extraction(const extract_options &options, const std::function<void(const file_meta &)> &fn) {
+    auto entries = m_table.file_entries();
+    std::vector<file_meta> selected;
+    if (options.filter) {
+        std::copy_if(entries.begin(), entries.end(), std::back_inserter(selected), options.filter);
+        entries = span<const file_meta>(selected);
+    }
+
+    read_coalescer coalescer(options.coalesce_gap, options.coalesce_max);
+    extract_plan plan(m_table, entries, coalescer, g_extract_read_ahead);
+    auto jobs = plan.jobs();
+    thread_pool pool(options.threads);
+
+    if (options.in_order) {
+        pool.run_in_order(jobs.size(), [this, &plan, &fn, jobs](std::size_t, std::size_t i) {
+            plan.read_ahead(m_file, i);
+            fn(*jobs[i].meta);
+        });
+        return;
     }
+
+    auto costs = plan.costs(g_file_creation_cost);
+    pool.run(costs, [&fn, jobs](std::size_t, std::size_t i) {
+        fn(*jobs[i].meta);
+    });
 }
 
-void archive::extract_all(file_sink &sink) {
-    auto &entries = m_table.file_entries();
-    std::for_each(entries.begin(), entries.end(), [this, &sink](std::pair<std::uint64_t, file_meta> pair) {
-        auto m = pair.second;
-        auto name = make_filename(m.m_hash);
+void archive::extract_all(file_sink &sink, const extract_options &options) {
+    if (options.dedup) {
+        extract_deduplicated(sink, options);
+        return;
+    }
+    run_extraction(options, [this, &sink, &options](const file_meta &m) {
+        extract_entry(sink, m, options);
+    });
+    sink.flush();
+}
 
-        auto out_stream = sink.new_stream(name);
-        extract_file_by_meta(out_stream, m);
-        out_stream.close();
+bool archive::extract_entry(file_sink &sink, const file_meta &m, const extract_options &options) {
+    if (is_compressed(m)) {
+        return sink.write_file(make_filename(m.m_hash), decode_file(m, options.decode_threads));
+    }
+    if (options.kernel_copy) {
+        return sink.write_file(make_filename(m.m_hash), m_file, segments_of(m));
+    }
+    return sink.write_file(make_filename(m.m_hash), segments_of(m));
+}
+
+void archive::extract_deduplicated(file_sink &sink, const extract_options &options) {
+    auto entries = m_table.file_entries();
+
+    // Content is told apart by its SHA-1, or where an entry has none by the
+    // segments it is stored in. The first entry of every content is written.
+    std::map<std::array<std::uint8_t, 20>, const file_meta *> by_sha1;
+    std::map<std::pair<std::uint32_t, std::uint32_t>, const file_meta *> by_segments;
+    std::vector<char> written(entries.size(), 0);
+    std::vector<std::pair<const file_meta *, const file_meta *>> duplicates;
+    for (auto &entry : entries) {
+        if (options.filter && !options.filter(entry)) {
+            continue;
+        }
+        auto &original = entry.m_sha1 != std::array<std::uint8_t, 20>{} ? by_sha1[entry.m_sha1] : by_segments[{entry.m_first_sector, entry.m_last_sector}];
+        if (original == nullptr) {
+            original = &entry;
+            written[entry.m_id] = 1;
+        } else if (original->m_hash != entry.m_hash) {
+            duplicates.emplace_back(&entry, original);
+        }
+    }
+
+    auto originals = options;
+    originals.filter = [&written](const file_meta &meta) {
+        return written[meta.m_id] != 0;
+    };
+    std::vector<char> failed(entries.size(), 0);
+    run_extraction(originals, [this, &sink, &options, &failed](const file_meta &m) {
+        if (!extract_entry(sink, m, options)) {
+            failed[m.m_id] = 1;
+        }
+    });
+    sink.flush();
+
+    // Links need their target complete. Duplicates of originals that could
+    // not be written, and those the sink cannot link, are written like any
+    // other file.
+    std::vector<char> unlinked(entries.size(), 0);
+    thread_pool pool(options.threads);
+    pool.run_in_order(duplicates.size(), [this, &sink, &options, &duplicates, &failed, &unlinked](std::size_t, std::size_t i) {
+        auto [duplicate, original] = duplicates[i];
+        if (failed[original->m_id] != 0 || sink.failed(make_filename(original->m_hash)) ||
+            !sink.link_file(make_filename(duplicate->m_hash), make_filename(original->m_hash), *options.dedup)) {
+            unlinked[duplicate->m_id] = 1;
+        }
+    });
+    if (std::find(unlinked.begin(), unlinked.end(), 1) == unlinked.end()) {
+        return;
+    }
+    auto rest = options;
+    rest.filter = [&unlinked](const file_meta &meta) {
+        return unlinked[meta.m_id] != 0;
+    };
+    run_extraction(rest, [this, &sink, &options](const file_meta &m) {
+        extract_entry(sink, m, options);
     });
+    sink.flush();
+}
+
+void archive::extract_changed(disk_sink &sink, manifest &m, const extract_options &options) {
+    auto changed = options;
+    changed.filter = [this, &sink, &m, &options](const file_meta &meta) {
+        if (options.filter && !options.filter(meta)) {
+            return false;
+        }
+        auto size = size_by_meta(meta);
+        return !m.is_current(meta, size) || !sink.holds(make_filename(meta.m_hash), size);
+    };
+    extract_all(sink, changed);
+
+    // Files that failed are left out, so the next run extracts them again.
+    for (auto &meta : m_table.file_entries()) {
+        if ((!options.filter || options.filter(meta)) && !sink.failed(make_filename(meta.m_hash))) {
+            m.record(meta, size_by_meta(meta));
+        }
+    }
 }
 
-void archive::extract_all_convert_wem(file_sink &sink) {
-    auto &entries = m_table.file_entries();
-    std::for_each(entries.begin(), entries.end(), [this, &sink](std::pair<std::uint64_t, file_meta> pair) {
-        auto m = pair.second;
-        auto name = make_filename(m.m_hash);
+void archive::extract_bundle(const std::string &path, const extract_options &options) {
+    auto entries = m_table.file_entries();
+
+    std::vector<bundle_file> files;
+    std::vector<std::size_t> slots(entries.size(), std::numeric_limits<std::size_t>::max());
+    for (auto &entry : entries) {
+        if (m_table.find(entry.m_hash) != &entry) {
+            continue;
+        }
+        slots[entry.m_id] = files.size();
+        files.push_back(bundle_file{.hash = entry.m_hash, .name = make_filename(entry.m_hash), .size = size_by_meta(entry)});
+    }
 
-        if (!is_wem_file(m)) {
+    bundle_writer writer(path, files);
+    run_extraction(options, [this, &writer, &slots, &options](const file_meta &m) {
+        auto slot = slots[m.m_id];
+        if (slot == std::numeric_limits<std::size_t>::max()) {
             return;
         }
+        if (is_compressed(m)) {
+            auto data = decode_file(m, options.decode_threads);
+            byte_span part(data.data(), data.size());
+            writer.write(slot, span<const byte_span>(&part, 1));
+        } else if (options.kernel_copy) {
+            writer.write(slot, m_file, segments_of(m));
+        } else {
+            writer.write(slot, segments_of(m));
+        }
+    });
+    writer.finish();
+}
 
-        auto dot_at = name.find_last_of('.');
-        auto out_stream = sink.new_stream(name.substr(0, dot_at) + ".ogg");
+void archive::extract_all_convert_wem(file_sink &sink, const extract_options &options) {
+    run_extraction(options, [this, &sink](const file_meta &m) {
+        convert_wem_entry(sink, m);
+    });
+    sink.flush();
+}
 
-        try {
-            extract_single_convert_wem(out_stream, m);
-        } catch (parse_error_str &e) {
-            fmt::print("could not extract file: {}\n", name);
+std::optional<std::uint64_t> archive::convert_wem_entry(file_sink &sink, const file_meta &m) {
+    if (!is_wem_file(m)) {
+        return std::nullopt;
+    }
+
+    std::ostringstream out_stream;
+    try {
+        extract_single_convert_wem(out_stream, m);
+    } catch (parse_error_str &e) {
+        fmt::print("could not extract file: {}\n", make_filename(m.m_hash));
+    }
+    auto content = out_stream.str();
+    auto size = content.size();
+    if (!sink.write_file(wem_output_name(m.m_hash), std::move(content))) {
+        return std::nullopt;
+    }
+    return size;
+}
+
+std::string archive::wem_output_name(std::uint64_t hash) const {
+    auto name = make_filename(hash);
+    return name.substr(0, name.find_last_of('.')) + ".ogg";
+}
+
+void archive::extract_resumable(disk_sink &sink, journal &j, bool convert_wem, const extract_options &options) {
+    auto remaining = options;
+    remaining.filter = [&j, &options](const file_meta &meta) {
+        if (options.filter && !options.filter(meta)) {
+            return false;
+        }
+        return !j.finished(meta.m_hash);
+    };
+
+    run_extraction(remaining, [this, &sink, &j, convert_wem, &options](const file_meta &m) {
+        if (!convert_wem) {
+            if (extract_entry(sink, m, options)) {
+                j.record(m.m_hash, size_by_meta(m));
+            }
+        } else if (auto size = convert_wem_entry(sink, m)) {
+            j.record(m.m_hash, *size);
         }
     });
+    sink.flush();
+    j.commit();
 }
 
 void archive::extract_single_convert_wem(std::ostream &s, const file_meta &meta) {
@@ -1,12 +1,29 @@
 #pragma once
+#include "bundle.h"
+#include "codec.h"
+#include "dictionary.h"
+#include "disk_sink.h"
+#include "file_index.h"
 #include "file_sink.h"
+#include "mapped_file.h"
 #include "reader.h"
+#include "segment_cache.h"
+#include "thread_pool.h"
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
 
 namespace rdar {
 
+class index_cache;
+struct index_cache_key;
+
 class header {
     std::uint64_t m_table_offset{};
     std::uint64_t m_table_size{};
@@ -16,8 +33,8 @@ class header {
 public:
     void deserialize(reader &r);
 
-    [[nodiscard]] constexpr std::uint64_t table_offset() const;
-    ;
+    [[nodiscard]] constexpr std::uint64_t table_offset() const { return m_table_offset; }
+    [[nodiscard]] constexpr std::uint64_t table_size() const { return m_table_size; }
 };
 
 class file_meta {
@@ -51,18 +68,84 @@ class table {
     std::uint32_t m_num_files{};
     std::uint32_t m_num_offsets{};
     std::uint32_t m_num_hashes{};
+    // Segments must lie within this many bytes of the archive.
+    std::uint64_t m_archive_size{};
 
-    std::unordered_map<std::uint64_t, file_meta> m_file_entries{};
-    std::vector<offset> m_offsets{};
-    std::vector<std::uint64_t> m_hashes{};
+    // Raw sections located when the table is opened and decoded on first access.
+    byte_span m_entry_section{};
+    byte_span m_offset_section{};
+    byte_span m_dependency_section{};
 
-public:
-    void deserialize(reader &r);
+    mutable std::once_flag m_entries_decoded;
+    mutable std::once_flag m_offsets_decoded;
+    mutable std::once_flag m_dependencies_decoded;
+    mutable std::atomic<bool> m_has_entries{false};
+
+    mutable std::vector<file_meta> m_entry_storage{};
+    mutable std::vector<offset> m_offset_storage{};
+    mutable std::vector<std::uint64_t> m_hash_storage{};
 
-    [[nodiscard]] const std::unordered_map<std::uint64_t, file_meta> &file_entries() const;
-    [[nodiscard]] const std::vector<offset> &file_offsets() const;
+    mutable span<const file_meta> m_file_entries{};
+    mutable file_index m_index{};
+    mutable span<const offset> m_offsets{};
+    mutable span<const std::uint64_t> m_hashes{};
+
+public:
+    // Validates the table header and locates its sections without decoding them.
+    void deserialize(reader &r, std::uint64_t archive_size);
+    // Uses the table stored in an index cache instead of parsing one.
+    void attach(const index_cache &cache, std::uint64_t archive_size);
+
+    [[nodiscard]] std::uint64_t checksum() const;
+    // Entries in table order.
+    [[nodiscard]] span<const file_meta> file_entries() const;
+    [[nodiscard]] span<const offset> file_offsets() const;
+    [[nodiscard]] span<const std::uint64_t> dependency_hashes() const;
+    [[nodiscard]] const file_index &index() const;
     [[nodiscard]] const file_meta &meta_of(std::uint64_t hash) const;
-    [[nodiscard]] const offset &offset_at(std::uint32_t id) const;
+    [[nodiscard]] const file_meta *find(std::uint64_t hash) const;
+    // Looks up many hashes at once; missing entries resolve to nullptr.
+    [[nodiscard]] std::vector<const file_meta *> find_many(span<const std::uint64_t> hashes) const;
+    // Looks up a single entry. Until the entries are decoded this scans the raw
+    // hashes instead of decoding and indexing the whole entry section.
+    [[nodiscard]] std::optional<file_meta> lookup(std::uint64_t hash) const;
+    // The entry at a position in table order. Until the entries are decoded
+    // only that entry is.
+    [[nodiscard]] file_meta entry_at(std::uint32_t position) const;
+    [[nodiscard]] offset offset_at(std::uint32_t id) const;
+    // Throws unless an entry's segments are all in the table.
+    void check_entry(const file_meta &meta) const;
+
+private:
+    void decode_entries() const;
+    void decode_offsets() const;
+    void decode_dependencies() const;
+    // Throws unless the segment lies within the archive.
+    void check_offset(const offset &off) const;
+};
+
+struct extract_options {
+    std::size_t threads = 1;
+    // Hand files out strictly in physical order instead of letting workers
+    // steal each other's shares.
+    bool in_order = true;
+    // Neighbouring files less than coalesce_gap bytes apart are read together,
+    // in reads of up to coalesce_max bytes.
+    std::uint64_t coalesce_gap = 64 * 1024;
+    std::uint64_t coalesce_max = 8 * 1024 * 1024;
+    // Queue output files through io_uring when the system supports it.
+    bool async_io = true;
+    // Let the kernel copy uncompressed files from the archive to the output.
+    bool kernel_copy = true;
+    // Print every file as it is written.
+    bool verbose = false;
+    // Threads decoding the segments of one large compressed file.
+    std::size_t decode_threads = 1;
+    // When set, only entries it accepts are extracted.
+    std::function<bool(const file_meta &)> filter;
+    // When set, entries with the same content are written once and the
+    // others linked to that file.
+    std::optional<link_kind> dedup;
 };
 
 struct file_parsed_info {
@@ -72,26 +155,80 @@ struct file_parsed_info {
     std::uint64_t hash;
 };
 
+class journal;
+class manifest;
+
 class archive {
-    reader m_reader;
-    std::unordered_map<std::uint64_t, std::string> m_hashes;
+    const mapped_file &m_file;
+    byte_span m_data;
+    const dictionary *m_names = nullptr;
     header m_header{};
     table m_table{};
     std::string m_codebooks_file;
+    const codec_registry &m_codecs;
+    segment_cache *m_segment_cache = nullptr;
+
+    // Names resolved ahead of time by an index cache, by entry position.
+    span<const std::uint32_t> m_name_offsets{};
+    byte_span m_name_pool{};
 
 public:
-    archive(std::istream &fs, std::unordered_map<std::uint64_t, std::string> hashes, std::string codebooks_file);
+    archive(const mapped_file &file, std::string codebooks_file, const codec_registry &codecs);
+    archive(const mapped_file &file, const index_cache &cache, std::string codebooks_file, const codec_registry &codecs);
+
+    // Keeps decoded compressed segments in the cache, for callers that read
+    // the same files over and over.
+    void attach(segment_cache &cache);
+    // Names entries from the dictionary; unnamed ones are named by hash.
+    void attach(const dictionary &names);
 
     std::string make_filename(std::uint64_t hash) const;
+    [[nodiscard]] const table &file_table() const;
+    // Writes the parsed table and the names resolved for it to an index cache.
+    [[nodiscard]] bool save_index(const std::string &path, const index_cache_key &key) const;
     std::vector<file_parsed_info> list_files();
-    void extract_file(std::ostream &s, std::uint64_t hash);
+    // Hashes of the entries that have no name.
+    [[nodiscard]] std::vector<std::uint64_t> unnamed_hashes() const;
+    void extract_file(std::ostream &s, std::uint64_t hash, std::size_t decode_threads = 1);
+    // Writes an entry to a descriptor. Uncompressed data is not copied
+    // through user space.
+    void extract_file(int fd, std::uint64_t hash, std::size_t decode_threads = 1);
+    void extract_file(int fd, const file_meta &meta, std::size_t decode_threads = 1);
     void extract_file_by_meta(std::ostream &s, const file_meta &meta);
-    void extract_all(file_sink &sink);
-    void extract_all_convert_wem(file_sink &sink);
+    [[nodiscard]] bool is_compressed(const file_meta &meta);
+    // The data of an uncompressed file as views into the archive, one per
+    // physically contiguous run.
+    [[nodiscard]] std::vector<byte_span> segments_of(const file_meta &meta);
+    // The decoded data of a file. Large files have their segments decoded in
+    // parallel, straight into their place in the result.
+    [[nodiscard]] std::string decode_file(const file_meta &meta, std::size_t threads = 1);
+    void extract_all(file_sink &sink, const extract_options &options = {});
+    void extract_all_convert_wem(file_sink &sink, const extract_options &options = {});
+    // Extracts only the entries whose content changed since the manifest was
+    // written or whose output is missing, then records every entry in it
+    // except those the sink could not write.
+    void extract_changed(disk_sink &sink, manifest &m, const extract_options &options = {});
+    // Extracts, or with convert_wem converts, what an interrupted run left
+    // unfinished, recording every entry written in the journal. The sink
+    // should be durable, so no record outlives its file's data.
+    void extract_resumable(disk_sink &sink, journal &j, bool convert_wem, const extract_options &options = {});
+    // Writes every file into a single bundle, which readers use straight from
+    // a mapping. Where several entries share a hash only the last one is kept.
+    void extract_bundle(const std::string &path, const extract_options &options = {});
     [[nodiscard]] std::size_t size_by_meta(const file_meta &meta);
 
 private:
     [[nodiscard]] bool is_wem_file(const file_meta &meta);
+    void decode_segment(std::size_t index, span<char> out);
+    [[nodiscard]] segment_cache::buffer decoded_segment(std::size_t index);
+    void run_extraction(const extract_options &options, const std::function<void(const file_meta &)> &fn);
+    // Returns false if the sink could not write the file.
+    bool extract_entry(file_sink &sink, const file_meta &m, const extract_options &options);
+    void extract_deduplicated(file_sink &sink, const extract_options &options);
+    // Returns the size of the converted file, if the entry is a WEM file and
+    // the sink could write it.
+    std::optional<std::uint64_t> convert_wem_entry(file_sink &sink, const file_meta &m);
+    [[nodiscard]] std::string wem_output_name(std::uint64_t hash) const;
     void extract_single_convert_wem(std::ostream &s, const file_meta &meta);
 };
 
@@ -0,0 +1,247 @@
+#include "bundle.h"
+#include "util.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fmt/core.h>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace rdar {
+
+constexpr auto g_bundle_magic = std::array<char, 8>{'R', 'D', 'A', 'R', 'B', 'N', 'D', 'L'};
+constexpr std::uint32_t g_bundle_version = 1;
+// Every file starts on a cache line, and the data on a page.
+constexpr std::uint64_t g_bundle_alignment = 64;
+constexpr std::uint64_t g_bundle_data_alignment = 4096;
+
+struct bundle_header {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t alignment;
+    std::uint64_t num_entries;
+    std::uint64_t entries_offset;
+    std::uint64_t name_pool_offset;
+    std::uint64_t name_pool_size;
+    std::uint64_t data_offset;
+    std::uint64_t data_size;
+    std::uint64_t total_size;
+};
+
+static_assert(sizeof(bundle_entry) == 32, "bundle entries are stored verbatim");
+
+static std::uint64_t align_up(std::uint64_t value, std::uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+bundle_writer::bundle_writer(std::string path, span<const bundle_file> files) : m_path(std::move(path)) {
+    std::vector<std::size_t> order(files.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&files](std::size_t a, std::size_t b) {
+        return files[a].hash < files[b].hash;
+    });
+
+    std::string name_pool;
+    std::vector<bundle_entry> entries(files.size());
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        auto &file = files[order[i]];
+        if (name_pool.size() + file.name.size() > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::runtime_error("bundle names too large");
+        }
+        entries[i].hash = file.hash;
+        entries[i].size = file.size;
+        entries[i].name_offset = static_cast<std::uint32_t>(name_pool.size());
+        entries[i].name_size = static_cast<std::uint32_t>(file.name.size());
+        name_pool += file.name;
+    }
+
+    bundle_header hdr{};
+    hdr.magic = g_bundle_magic;
+    hdr.version = g_bundle_version;
+    hdr.alignment = g_bundle_alignment;
+    hdr.num_entries = entries.size();
+    hdr.entries_offset = align_up(sizeof(bundle_header), alignof(bundle_entry));
+    hdr.name_pool_offset = hdr.entries_offset + entries.size() * sizeof(bundle_entry);
+    hdr.name_pool_size = name_pool.size();
+    hdr.data_offset = align_up(hdr.name_pool_offset + name_pool.size(), g_bundle_data_alignment);
+
+    // After the header, the entries in hash order and the name pool comes the
+    // page-aligned data: every file in input order, not hash order, each at
+    // the next multiple of g_bundle_alignment.
+    m_offsets.resize(files.size());
+    m_sizes.resize(files.size());
+    auto at = hdr.data_offset;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        m_offsets[i] = at;
+        m_sizes[i] = files[i].size;
+        at = align_up(at + files[i].size, g_bundle_alignment);
+    }
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        entries[i].offset = m_offsets[order[i]];
+    }
+    hdr.data_size = at - hdr.data_offset;
+    hdr.total_size = at;
+
+    m_tmp_path = fmt::format("{}.{}.tmp", m_path, std::chrono::steady_clock::now().time_since_epoch().count());
+#ifdef _WIN32
+    m_fd = ::_open(m_tmp_path.c_str(), _O_RDWR | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    m_fd = ::open(m_tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+    if (m_fd < 0) {
+        throw std::runtime_error("could not create bundle");
+    }
+
+    std::string head(hdr.data_offset, '\0');
+    std::memcpy(head.data(), &hdr, sizeof(hdr));
+    if (!entries.empty()) {
+        std::memcpy(head.data() + hdr.entries_offset, entries.data(), entries.size() * sizeof(bundle_entry));
+    }
+    std::memcpy(head.data() + hdr.name_pool_offset, name_pool.data(), name_pool.size());
+
+    // Sizing the file first keeps the writes below from extending it.
+#ifdef _WIN32
+    auto sized = ::_chsize_s(m_fd, static_cast<long long>(hdr.total_size)) == 0;
+#else
+    auto sized = ::ftruncate(m_fd, static_cast<off_t>(hdr.total_size)) == 0;
+#endif
+    if (!sized || !write_all_at(m_fd, byte_span(head.data(), head.size()), 0)) {
+        close();
+        throw std::runtime_error("could not write bundle");
+    }
+}
+
+bundle_writer::~bundle_writer() {
+    if (m_fd >= 0) {
+        close();
+        std::error_code ec;
+        std::filesystem::remove(m_tmp_path, ec);
+    }
+}
+
+void bundle_writer::check_size(std::size_t i, span<const byte_span> parts) const {
+    std::uint64_t size = 0;
+    for (auto &part : parts) {
+        size += part.size();
+    }
+    if (i >= m_sizes.size() || size != m_sizes[i]) {
+        throw std::runtime_error("bundle file size mismatch");
+    }
+}
+
+void bundle_writer::write(std::size_t i, span<const byte_span> parts) {
+    check_size(i, parts);
+    auto at = m_offsets[i];
+    for (auto &part : parts) {
+        if (!write_all_at(m_fd, part, at)) {
+            throw std::runtime_error("could not write bundle");
+        }
+        at += part.size();
+    }
+}
+
+void bundle_writer::write(std::size_t i, const mapped_file &source, span<const byte_span> parts) {
+    check_size(i, parts);
+    auto base = source.data().data();
+    auto at = m_offsets[i];
+    for (auto &part : parts) {
+        if (!source.write_to(m_fd, static_cast<std::uint64_t>(part.data() - base), part.size(), at)) {
+            throw std::runtime_error("could not write bundle");
+        }
+        at += part.size();
+    }
+}
+
+void bundle_writer::finish() {
+    close();
+    std::error_code ec;
+    std::filesystem::rename(m_tmp_path, m_path, ec);
+    if (ec) {
+        std::filesystem::remove(m_tmp_path, ec);
+        throw std::runtime_error("could not write bundle");
+    }
+}
+
+void bundle_writer::close() {
+#ifdef _WIN32
+    ::_close(m_fd);
+#else
+    ::close(m_fd);
+#endif
+    m_fd = -1;
+}
+
+bundle::bundle(const std::string &path) : m_file(path) {
+    auto data = m_file.data();
+    if (data.size() < sizeof(bundle_header)) {
+        return;
+    }
+
+    auto hdr = reinterpret_cast<const bundle_header *>(data.data());
+    if (hdr->magic != g_bundle_magic || hdr->version != g_bundle_version || hdr->total_size != data.size()) {
+        return;
+    }
+    if (hdr->entries_offset % alignof(bundle_entry) != 0 || hdr->entries_offset > data.size() ||
+        hdr->num_entries > (data.size() - hdr->entries_offset) / sizeof(bundle_entry) ||
+        hdr->name_pool_offset > data.size() || hdr->name_pool_size > data.size() - hdr->name_pool_offset ||
+        hdr->data_offset > data.size() || hdr->data_size > data.size() - hdr->data_offset) {
+        return;
+    }
+
+    m_header = hdr;
+}
+
+bool bundle::is_valid() const {
+    return m_header != nullptr;
+}
+
+span<const bundle_entry> bundle::entries() const {
+    if (m_header == nullptr) {
+        return {};
+    }
+    return span<const bundle_entry>(reinterpret_cast<const bundle_entry *>(m_file.data().data() + m_header->entries_offset), m_header->num_entries);
+}
+
+const bundle_entry *bundle::find(std::uint64_t hash) const {
+    auto all = entries();
+    auto it = std::lower_bound(all.begin(), all.end(), hash, [](const bundle_entry &entry, std::uint64_t h) {
+        return entry.hash < h;
+    });
+    if (it == all.end() || it->hash != hash) {
+        return nullptr;
+    }
+    return it;
+}
+
+const bundle_entry *bundle::find(std::string_view name) const {
+    return find(fnv1a64(name));
+}
+
+std::string_view bundle::name_of(const bundle_entry &entry) const {
+    auto pool = m_file.data().subspan(m_header->name_pool_offset, m_header->name_pool_size);
+    if (entry.name_offset > pool.size() || entry.name_size > pool.size() - entry.name_offset) {
+        return {};
+    }
+    return std::string_view(pool.data() + entry.name_offset, entry.name_size);
+}
+
+byte_span bundle::data_of(const bundle_entry &entry) const {
+    auto data = m_file.data();
+    if (entry.offset > data.size() || entry.size > data.size() - entry.offset) {
+        return {};
+    }
+    return data.subspan(entry.offset, entry.size);
+}
+
+}// namespace rdar
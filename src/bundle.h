@@ -0,0 +1,77 @@
+#pragma once
+#include "mapped_file.h"
+#include "span.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rdar {
+
+struct bundle_header;
+
+// One file in a bundle. Offsets are absolute within the bundle.
+struct bundle_entry {
+    std::uint64_t hash;
+    std::uint64_t offset;
+    std::uint64_t size;
+    std::uint32_t name_offset;
+    std::uint32_t name_size;
+};
+
+// Describes a file to be laid out in a bundle.
+struct bundle_file {
+    std::uint64_t hash;
+    std::string name;
+    std::uint64_t size;
+};
+
+// Writes a bundle: a header, the entries sorted by hash, the name pool and
+// the data of every file at an aligned offset. The layout is fixed up front,
+// so files may be written in any order and from several threads at once.
+// The bundle only appears at its path once finish succeeds.
+class bundle_writer {
+    std::string m_path;
+    std::string m_tmp_path;
+    int m_fd = -1;
+    // File i of the input is written at m_offsets[i].
+    std::vector<std::uint64_t> m_offsets;
+    std::vector<std::uint64_t> m_sizes;
+
+public:
+    bundle_writer(std::string path, span<const bundle_file> files);
+    ~bundle_writer();
+
+    bundle_writer(const bundle_writer &) = delete;
+    bundle_writer &operator=(const bundle_writer &) = delete;
+
+    // Writes the data of file i from consecutive parts.
+    void write(std::size_t i, span<const byte_span> parts);
+    // Writes the data of file i from parts that are views into source.
+    void write(std::size_t i, const mapped_file &source, span<const byte_span> parts);
+    void finish();
+
+private:
+    void check_size(std::size_t i, span<const byte_span> parts) const;
+    void close();
+};
+
+// A bundle opened for reading, used straight from its mapping.
+class bundle {
+    mapped_file m_file;
+    const bundle_header *m_header = nullptr;
+
+public:
+    explicit bundle(const std::string &path);
+
+    [[nodiscard]] bool is_valid() const;
+    // Sorted by hash.
+    [[nodiscard]] span<const bundle_entry> entries() const;
+    // Returns nullptr if the bundle holds no such file.
+    [[nodiscard]] const bundle_entry *find(std::uint64_t hash) const;
+    [[nodiscard]] const bundle_entry *find(std::string_view name) const;
+    [[nodiscard]] std::string_view name_of(const bundle_entry &entry) const;
+    [[nodiscard]] byte_span data_of(const bundle_entry &entry) const;
+};
+
+}// namespace rdar
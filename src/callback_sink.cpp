@@ -0,0 +1,14 @@
+#include "callback_sink.h"
+#include <utility>
+
+namespace rdar {
+
+callback_sink::callback_sink(callback fn) : m_callback(std::move(fn)) {
+}
+
+bool callback_sink::write_file(std::string path, span<const byte_span> parts) {
+    m_callback(path, parts);
+    return true;
+}
+
+}// namespace rdar
@@ -0,0 +1,25 @@
+#pragma once
+#include "file_sink.h"
+#include <functional>
+#include <string>
+
+namespace rdar {
+
+// Hands every extracted file to a callback instead of storing it. The parts
+// are only valid during the call, and extraction with several threads calls
+// it concurrently.
+class callback_sink : public file_sink {
+public:
+    using callback = std::function<void(const std::string &path, span<const byte_span> parts)>;
+
+private:
+    callback m_callback;
+
+public:
+    explicit callback_sink(callback fn);
+
+    using file_sink::write_file;
+    bool write_file(std::string path, span<const byte_span> parts) override;
+};
+
+}// namespace rdar
@@ -0,0 +1,263 @@
+#include "catalog.h"
+#include "util.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fmt/core.h>
+#include <fstream>
+
+namespace rdar {
+
+constexpr auto g_catalog_magic = std::array<char, 8>{'R', 'D', 'A', 'R', 'C', 'T', 'L', 'G'};
+constexpr std::uint32_t g_catalog_version = 1;
+constexpr std::uint64_t g_catalog_alignment = 8;
+// Blocks of 512 bits, one cache line, with about 10 bits per hash and 7 of
+// them set for each, so about one lookup in a hundred is a false positive.
+constexpr std::uint64_t g_bloom_block_words = 8;
+constexpr std::uint64_t g_bloom_bits_per_hash = 10;
+constexpr unsigned g_bloom_probes = 7;
+
+struct catalog_header {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t bloom_probes;
+    std::uint64_t fingerprint;
+
+    std::uint64_t num_archives;
+    std::uint64_t archives_offset;
+    std::uint64_t paths_offset;
+    std::uint64_t paths_size;
+    std::uint64_t bloom_offset;
+    std::uint64_t bloom_words;
+    std::uint64_t num_hashes;
+    std::uint64_t hashes_offset;
+    std::uint64_t entries_offset;
+
+    std::uint64_t total_size;
+};
+
+struct catalog_archive {
+    std::uint64_t path_offset;
+    std::uint64_t path_size;
+    std::uint64_t table_checksum;
+    // In words of the Bloom filter section; a power of two of blocks.
+    std::uint64_t bloom_first;
+    std::uint64_t bloom_blocks;
+    // In the hash and entry sections.
+    std::uint64_t first_hash;
+    std::uint64_t num_hashes;
+};
+
+namespace {
+
+// The bits of a hash within its block, taken from a remix of the hash so they
+// do not repeat the bits that picked the block.
+template <typename F>
+void for_each_bloom_bit(std::uint64_t hash, F &&fn) {
+    auto mixed = hash * 0x9e3779b97f4a7c15;
+    for (unsigned probe = 0; probe < g_bloom_probes; ++probe) {
+        fn(static_cast<unsigned>(mixed >> (probe * 9)) & 511);
+    }
+}
+
+std::uint64_t bloom_block(std::uint64_t hash, std::uint64_t blocks) {
+    return (hash >> 32) & (blocks - 1);
+}
+
+}// namespace
+
+catalog::catalog(const std::string &path) : m_file(path) {
+    auto data = m_file.data();
+    if (data.size() < sizeof(catalog_header)) {
+        return;
+    }
+
+    auto hdr = reinterpret_cast<const catalog_header *>(data.data());
+    if (hdr->magic != g_catalog_magic || hdr->version != g_catalog_version ||
+        hdr->bloom_probes != g_bloom_probes || hdr->total_size != data.size()) {
+        return;
+    }
+
+    auto fits = [&data](std::uint64_t offset, std::uint64_t count, std::uint64_t element_size) {
+        return offset % g_catalog_alignment == 0 && offset <= data.size() &&
+               count <= (data.size() - offset) / element_size;
+    };
+    if (!fits(hdr->archives_offset, hdr->num_archives, sizeof(catalog_archive)) ||
+        !fits(hdr->paths_offset, hdr->paths_size, 1) ||
+        !fits(hdr->bloom_offset, hdr->bloom_words, sizeof(std::uint64_t)) ||
+        !fits(hdr->hashes_offset, hdr->num_hashes, sizeof(std::uint64_t)) ||
+        !fits(hdr->entries_offset, hdr->num_hashes, sizeof(std::uint32_t))) {
+        return;
+    }
+
+    m_archives = span<const catalog_archive>(reinterpret_cast<const catalog_archive *>(data.data() + hdr->archives_offset), hdr->num_archives);
+    for (auto &a : m_archives) {
+        if (a.path_offset > hdr->paths_size || a.path_size > hdr->paths_size - a.path_offset ||
+            a.bloom_blocks == 0 || (a.bloom_blocks & (a.bloom_blocks - 1)) != 0 ||
+            a.bloom_first > hdr->bloom_words || a.bloom_blocks * g_bloom_block_words > hdr->bloom_words - a.bloom_first ||
+            a.first_hash > hdr->num_hashes || a.num_hashes > hdr->num_hashes - a.first_hash) {
+            m_archives = {};
+            return;
+        }
+    }
+    m_paths = byte_span(data.data() + hdr->paths_offset, hdr->paths_size);
+    m_bloom = span<const std::uint64_t>(reinterpret_cast<const std::uint64_t *>(data.data() + hdr->bloom_offset), hdr->bloom_words);
+    m_hashes = span<const std::uint64_t>(reinterpret_cast<const std::uint64_t *>(data.data() + hdr->hashes_offset), hdr->num_hashes);
+    m_entries = span<const std::uint32_t>(reinterpret_cast<const std::uint32_t *>(data.data() + hdr->entries_offset), hdr->num_hashes);
+    m_header = hdr;
+}
+
+std::string catalog::path_for(const std::string &cache_dir, const std::string &directory) {
+    std::error_code ec;
+    auto absolute_path = std::filesystem::absolute(directory, ec);
+    auto key = ec ? directory : absolute_path.lexically_normal().string();
+    return fmt::format("{}/{:016x}.cat", cache_dir, fnv1a64(key));
+}
+
+bool catalog::write(const std::string &path, mount &m, std::uint64_t fingerprint) {
+    std::vector<catalog_archive> archives(m.size());
+    std::string paths;
+    std::vector<std::uint64_t> bloom;
+    std::vector<std::uint64_t> hashes;
+    std::vector<std::uint32_t> entries;
+    for (std::size_t i = 0; i < m.size(); ++i) {
+        auto &a = archives[i];
+        auto &index = m.archive_at(i).file_table().index();
+
+        a.path_offset = paths.size();
+        a.path_size = m.path_at(i).size();
+        paths += m.path_at(i);
+        a.table_checksum = m.archive_at(i).file_table().checksum();
+
+        a.bloom_first = bloom.size();
+        a.bloom_blocks = 1;
+        while (a.bloom_blocks * g_bloom_block_words * 64 < index.size() * g_bloom_bits_per_hash) {
+            a.bloom_blocks *= 2;
+        }
+        bloom.resize(bloom.size() + a.bloom_blocks * g_bloom_block_words);
+        auto block_words = bloom.data() + a.bloom_first;
+        for (auto hash : index.hashes()) {
+            auto words = block_words + bloom_block(hash, a.bloom_blocks) * g_bloom_block_words;
+            for_each_bloom_bit(hash, [words](unsigned bit) {
+                words[bit >> 6] |= std::uint64_t{1} << (bit & 63);
+            });
+        }
+
+        a.first_hash = hashes.size();
+        a.num_hashes = index.size();
+        hashes.insert(hashes.end(), index.hashes().begin(), index.hashes().end());
+        entries.insert(entries.end(), index.positions().begin(), index.positions().end());
+    }
+
+    catalog_header hdr{};
+    hdr.magic = g_catalog_magic;
+    hdr.version = g_catalog_version;
+    hdr.bloom_probes = g_bloom_probes;
+    hdr.fingerprint = fingerprint;
+
+    std::uint64_t size = sizeof(catalog_header);
+    auto place = [&size](std::uint64_t section_size) {
+        auto at = (size + g_catalog_alignment - 1) / g_catalog_alignment * g_catalog_alignment;
+        size = at + section_size;
+        return at;
+    };
+    hdr.num_archives = archives.size();
+    hdr.archives_offset = place(archives.size() * sizeof(catalog_archive));
+    hdr.paths_size = paths.size();
+    hdr.paths_offset = place(paths.size());
+    hdr.bloom_words = bloom.size();
+    hdr.bloom_offset = place(bloom.size() * sizeof(std::uint64_t));
+    hdr.num_hashes = hashes.size();
+    hdr.hashes_offset = place(hashes.size() * sizeof(std::uint64_t));
+    hdr.entries_offset = place(entries.size() * sizeof(std::uint32_t));
+    hdr.total_size = size;
+
+    std::string buffer(size, '\0');
+    auto put = [&buffer](std::uint64_t at, const void *data, std::size_t data_size) {
+        if (data_size != 0) {
+            std::memcpy(buffer.data() + at, data, data_size);
+        }
+    };
+    put(0, &hdr, sizeof(hdr));
+    put(hdr.archives_offset, archives.data(), archives.size() * sizeof(catalog_archive));
+    put(hdr.paths_offset, paths.data(), paths.size());
+    put(hdr.bloom_offset, bloom.data(), bloom.size() * sizeof(std::uint64_t));
+    put(hdr.hashes_offset, hashes.data(), hashes.size() * sizeof(std::uint64_t));
+    put(hdr.entries_offset, entries.data(), entries.size() * sizeof(std::uint32_t));
+
+    // Written next to the final path and renamed over it, so concurrent
+    // readers only ever see a complete catalog.
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    auto tmp_path = fmt::format("{}.{}.tmp", path, std::chrono::steady_clock::now().time_since_epoch().count());
+    {
+        std::ofstream out(tmp_path, std::ios::binary);
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        if (!out) {
+            out.close();
+            std::filesystem::remove(tmp_path, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+bool catalog::matches(std::uint64_t fingerprint) const {
+    return m_header != nullptr && m_header->fingerprint == fingerprint;
+}
+
+std::size_t catalog::size() const {
+    return m_archives.size();
+}
+
+std::string_view catalog::path_at(std::size_t i) const {
+    return std::string_view(m_paths.data() + m_archives[i].path_offset, m_archives[i].path_size);
+}
+
+std::optional<mount_entry> catalog::find_in(std::size_t i, std::uint64_t hash) const {
+    auto &a = m_archives[i];
+    auto words = m_bloom.data() + a.bloom_first + bloom_block(hash, a.bloom_blocks) * g_bloom_block_words;
+    bool maybe = true;
+    for_each_bloom_bit(hash, [words, &maybe](unsigned bit) {
+        maybe = maybe && (words[bit >> 6] >> (bit & 63) & 1) != 0;
+    });
+    if (!maybe) {
+        return std::nullopt;
+    }
+
+    auto begin = m_hashes.begin() + a.first_hash;
+    auto end = begin + a.num_hashes;
+    auto at = std::lower_bound(begin, end, hash);
+    if (at == end || *at != hash) {
+        return std::nullopt;
+    }
+    return mount_entry{static_cast<std::uint32_t>(i), m_entries[static_cast<std::size_t>(at - m_hashes.begin())]};
+}
+
+std::optional<mount_entry> catalog::find(std::uint64_t hash) const {
+    for (auto i = m_archives.size(); i-- > 0;) {
+        if (auto entry = find_in(i, hash)) {
+            return entry;
+        }
+    }
+    return std::nullopt;
+}
+
+std::vector<mount_entry> catalog::find_all(std::uint64_t hash) const {
+    std::vector<mount_entry> result;
+    for (std::size_t i = 0; i < m_archives.size(); ++i) {
+        if (auto entry = find_in(i, hash)) {
+            result.push_back(*entry);
+        }
+    }
+    return result;
+}
+
+}// namespace rdar
@@ -0,0 +1,56 @@
+#pragma once
+#include "mapped_file.h"
+#include "mount.h"
+#include "span.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rdar {
+
+struct catalog_header;
+struct catalog_archive;
+
+// Cache file telling which archives below a directory hold which hashes,
+// so a hash is located without opening any of them. Every archive has its
+// sorted hashes and a blocked Bloom filter of them; a lookup only searches
+// the hashes of archives whose filter lets the hash through, which costs
+// one cache line per archive for the others. The catalog is tied to the
+// fingerprint of the archives it was built from.
+class catalog {
+    mapped_file m_file;
+    const catalog_header *m_header = nullptr;
+    span<const catalog_archive> m_archives;
+    span<const std::uint64_t> m_bloom;
+    span<const std::uint64_t> m_hashes;
+    span<const std::uint32_t> m_entries;
+    byte_span m_paths;
+
+public:
+    explicit catalog(const std::string &path);
+
+    [[nodiscard]] static std::string path_for(const std::string &cache_dir, const std::string &directory);
+    // Writes the catalog of a mount, whose archives have the given
+    // fingerprint, atomically; returns false if it could not be written.
+    [[nodiscard]] static bool write(const std::string &path, mount &m, std::uint64_t fingerprint);
+
+    // Whether the catalog is valid and was built from archives with the
+    // fingerprint.
+    [[nodiscard]] bool matches(std::uint64_t fingerprint) const;
+
+    [[nodiscard]] std::size_t size() const;
+    // The path of an archive relative to the directory.
+    [[nodiscard]] std::string_view path_at(std::size_t i) const;
+    // The archive providing the hash: the last one in load order holding it.
+    [[nodiscard]] std::optional<mount_entry> find(std::uint64_t hash) const;
+    // Every archive holding the hash, in load order.
+    [[nodiscard]] std::vector<mount_entry> find_all(std::uint64_t hash) const;
+
+private:
+    [[nodiscard]] std::optional<mount_entry> find_in(std::size_t i, std::uint64_t hash) const;
+};
+
+}// namespace rdar
@@ -0,0 +1,159 @@
+#include "codec.h"
+#include "reader.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+namespace rdar {
+
+constexpr auto g_kraken_magic = std::array<char, 4>{'K', 'A', 'R', 'K'};
+constexpr auto g_rle_magic = std::array<char, 4>{'R', 'L', 'E', '1'};
+// Kraken decoders may write this many bytes past the end of their output.
+constexpr std::size_t g_kraken_overrun = 64;
+
+namespace {
+
+void *open_library(const std::string &path) {
+#ifdef _WIN32
+    return reinterpret_cast<void *>(LoadLibraryA(path.c_str()));
+#else
+    return ::dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+}
+
+void *find_symbol(void *library, const char *name) {
+#ifdef _WIN32
+    return reinterpret_cast<void *>(GetProcAddress(static_cast<HMODULE>(library), name));
+#else
+    return ::dlsym(library, name);
+#endif
+}
+
+void close_library(void *library) {
+#ifdef _WIN32
+    FreeLibrary(static_cast<HMODULE>(library));
+#else
+    ::dlclose(library);
+#endif
+}
+
+}// namespace
+
+#ifdef _WIN32
+const char *const kraken_codec::default_library = "oo2ext_7_win64.dll";
+#else
+const char *const kraken_codec::default_library = "liboo2corelinux64.so";
+#endif
+
+std::unique_ptr<kraken_codec> kraken_codec::load(const std::string &path) {
+    auto library = open_library(path);
+    if (library == nullptr) {
+        return nullptr;
+    }
+    auto result = std::make_unique<kraken_codec>(library);
+    if (result->m_oodle_decompress == nullptr && result->m_kraken_decompress == nullptr) {
+        return nullptr;
+    }
+    return result;
+}
+
+kraken_codec::kraken_codec(void *library) : m_library(library) {
+    m_oodle_decompress = reinterpret_cast<oodle_decompress>(find_symbol(library, "OodleLZ_Decompress"));
+    m_kraken_decompress = reinterpret_cast<kraken_decompress>(find_symbol(library, "Kraken_Decompress"));
+}
+
+kraken_codec::~kraken_codec() {
+    close_library(m_library);
+}
+
+std::array<char, 4> kraken_codec::magic() const {
+    return g_kraken_magic;
+}
+
+void kraken_codec::decode(byte_span payload, span<char> out) const {
+    // Decoded into scratch space with room for the overrun, since out is
+    // often a slice of a larger buffer that other threads are filling.
+    thread_local std::vector<char> scratch;
+    scratch.resize(out.size() + g_kraken_overrun);
+
+    std::intptr_t decoded;
+    if (m_oodle_decompress != nullptr) {
+        // Fuzz-safe, no CRC check, quiet, single-threaded.
+        decoded = m_oodle_decompress(payload.data(), static_cast<std::intptr_t>(payload.size()), scratch.data(), static_cast<std::intptr_t>(out.size()), 1, 0, 0, nullptr, 0, nullptr, nullptr, nullptr, 0, 3);
+    } else {
+        decoded = m_kraken_decompress(reinterpret_cast<const std::uint8_t *>(payload.data()), payload.size(), reinterpret_cast<std::uint8_t *>(scratch.data()), out.size());
+    }
+    if (decoded != static_cast<std::intptr_t>(out.size())) {
+        throw std::runtime_error("could not decompress segment");
+    }
+    std::memcpy(out.data(), scratch.data(), out.size());
+}
+
+std::array<char, 4> rle_codec::magic() const {
+    return g_rle_magic;
+}
+
+void rle_codec::decode(byte_span payload, span<char> out) const {
+    if (payload.size() % 2 != 0) {
+        throw std::runtime_error("could not decompress segment");
+    }
+    std::size_t at = 0;
+    for (std::size_t i = 0; i < payload.size(); i += 2) {
+        auto count = static_cast<std::uint8_t>(payload[i]);
+        if (count > out.size() - at) {
+            throw std::runtime_error("could not decompress segment");
+        }
+        std::memset(out.data() + at, payload[i + 1], count);
+        at += count;
+    }
+    if (at != out.size()) {
+        throw std::runtime_error("could not decompress segment");
+    }
+}
+
+codec_registry codec_registry::with_defaults(const std::string &kraken_library) {
+    codec_registry result;
+    result.add(std::make_unique<rle_codec>());
+    if (auto kraken = kraken_codec::load(kraken_library)) {
+        result.add(std::move(kraken));
+    }
+    return result;
+}
+
+void codec_registry::add(std::unique_ptr<codec> c) {
+    m_codecs.push_back(std::move(c));
+}
+
+const codec *codec_registry::find(std::array<char, 4> magic) const {
+    auto it = std::find_if(m_codecs.begin(), m_codecs.end(), [magic](const std::unique_ptr<codec> &c) {
+        return c->magic() == magic;
+    });
+    if (it == m_codecs.end()) {
+        return nullptr;
+    }
+    return it->get();
+}
+
+void codec_registry::decode(byte_span segment, span<char> out) const {
+    reader r(segment);
+    std::array<char, 4> magic{};
+    r.read_n(magic);
+    auto size = r.read<std::uint32_t>();
+    if (size != out.size()) {
+        throw std::runtime_error("segment size mismatch");
+    }
+
+    auto c = find(magic);
+    if (c == nullptr) {
+        throw std::runtime_error("compression not supported");
+    }
+    c->decode(r.read_span(r.remaining()), out);
+}
+
+}// namespace rdar
@@ -0,0 +1,75 @@
+#pragma once
+#include "span.h"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace rdar {
+
+// Decodes the payload of compressed segments of one kind. Compressed segments
+// start with a 4-byte codec magic followed by the little-endian u32 size of
+// the decoded segment.
+class codec {
+public:
+    virtual ~codec() = default;
+
+    [[nodiscard]] virtual std::array<char, 4> magic() const = 0;
+    // Decodes the payload, without the segment header, into exactly
+    // out.size() bytes. Throws on malformed input.
+    virtual void decode(byte_span payload, span<char> out) const = 0;
+};
+
+// Kraken (KARK) segments, decoded by an Oodle-compatible shared library
+// loaded at runtime. Both OodleLZ_Decompress and the Kraken_Decompress entry
+// point of open-source decoders are supported.
+class kraken_codec : public codec {
+    using oodle_decompress = std::intptr_t (*)(const void *, std::intptr_t, void *, std::intptr_t, int, int, int, void *, std::intptr_t, void *, void *, void *, std::intptr_t, int);
+    using kraken_decompress = int (*)(const std::uint8_t *, std::size_t, std::uint8_t *, std::size_t);
+
+    void *m_library = nullptr;
+    oodle_decompress m_oodle_decompress = nullptr;
+    kraken_decompress m_kraken_decompress = nullptr;
+
+public:
+    static const char *const default_library;
+
+    // Returns nullptr if the library cannot be loaded or has no decoder.
+    [[nodiscard]] static std::unique_ptr<kraken_codec> load(const std::string &path);
+
+    explicit kraken_codec(void *library);
+    ~kraken_codec() override;
+
+    kraken_codec(const kraken_codec &) = delete;
+    kraken_codec &operator=(const kraken_codec &) = delete;
+
+    [[nodiscard]] std::array<char, 4> magic() const override;
+    void decode(byte_span payload, span<char> out) const override;
+};
+
+// A trivial run-length codec, so compressed archives can be produced and
+// checked without a Kraken decoder. The payload is a sequence of
+// (count, byte) pairs.
+class rle_codec : public codec {
+public:
+    [[nodiscard]] std::array<char, 4> magic() const override;
+    void decode(byte_span payload, span<char> out) const override;
+};
+
+// Picks the codec for a segment by its magic.
+class codec_registry {
+    std::vector<std::unique_ptr<codec>> m_codecs;
+
+public:
+    // The built-in codecs plus Kraken if its library can be loaded.
+    [[nodiscard]] static codec_registry with_defaults(const std::string &kraken_library);
+
+    void add(std::unique_ptr<codec> c);
+    [[nodiscard]] const codec *find(std::array<char, 4> magic) const;
+    // Decodes a whole segment, header included, into exactly out.size()
+    // bytes.
+    void decode(byte_span segment, span<char> out) const;
+};
+
+}// namespace rdar
@@ -0,0 +1,287 @@
+#include "dictionary.h"
+#include "hash_filter.h"
+#include "util.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <numeric>
+#include <fmt/core.h>
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace rdar {
+
+constexpr auto g_dictionary_magic = std::array<char, 8>{'R', 'D', 'A', 'R', 'D', 'I', 'C', 'T'};
+constexpr std::uint32_t g_dictionary_version = 1;
+constexpr std::uint64_t g_dictionary_alignment = 8;
+// Sorted names are stored in full every this many; the ones in between only
+// store what differs from their predecessor.
+constexpr std::uint32_t g_dictionary_block_size = 16;
+
+struct dictionary_header {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t block_size;
+
+    std::uint64_t num_names;
+    std::uint64_t num_indexed;
+    std::uint64_t hashes_offset;
+    std::uint64_t positions_offset;
+    std::uint64_t buckets_offset;
+    std::uint64_t num_buckets;
+    std::uint32_t bucket_shift;
+    std::uint32_t reserved;
+    std::uint64_t blocks_offset;
+    std::uint64_t num_blocks;
+    std::uint64_t pool_offset;
+    std::uint64_t pool_size;
+
+    std::uint64_t total_size;
+};
+
+namespace {
+
+void put_varint(std::string &out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+bool get_varint(byte_span pool, std::uint64_t &at, std::uint64_t &value) {
+    value = 0;
+    for (unsigned shift = 0; at < pool.size() && shift < 64; shift += 7) {
+        auto byte = static_cast<unsigned char>(pool[at++]);
+        value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}// namespace
+
+dictionary::dictionary(const std::string &path, std::size_t threads) : m_file(std::make_unique<mapped_file>(path)) {
+    if (m_file->is_open() && !assign(m_file->data())) {
+        compile_list(read_hashes(m_file->data(), threads));
+    }
+}
+
+dictionary::dictionary(const std::string &path, std::size_t threads, const file_index &only) : m_file(std::make_unique<mapped_file>(path)) {
+    if (!m_file->is_open() || assign(m_file->data())) {
+        return;
+    }
+
+    hash_filter filter(only);
+    compile_list(read_hashes(m_file->data(), threads, [&filter](std::uint64_t hash) {
+        return filter.contains(hash);
+    }));
+}
+
+void dictionary::compile_list(const std::vector<std::pair<std::uint64_t, std::string_view>> &names) {
+    // Sorting the names would take longer than the list is used for.
+    m_storage = compile(names, false);
+    m_file.reset();
+    if (!assign(byte_span(m_storage.data(), m_storage.size()))) {
+        throw std::runtime_error("could not compile dictionary");
+    }
+}
+
+std::string dictionary::compile(span<const std::pair<std::uint64_t, std::string_view>> names, bool front_code) {
+    std::vector<std::uint32_t> order(names.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (front_code) {
+        // Where a hash is listed again its last name wins, as it does in the
+        // index.
+        std::stable_sort(order.begin(), order.end(), [&names](std::uint32_t a, std::uint32_t b) {
+            return names[a].first < names[b].first;
+        });
+        auto last = std::unique(order.rbegin(), order.rend(), [&names](std::uint32_t a, std::uint32_t b) {
+            return names[a].first == names[b].first;
+        });
+        order.erase(order.begin(), last.base());
+        std::sort(order.begin(), order.end(), [&names](std::uint32_t a, std::uint32_t b) {
+            return names[a].second < names[b].second;
+        });
+    }
+    auto block_size = front_code ? g_dictionary_block_size : 1;
+
+    std::vector<std::uint64_t> hashes;
+    std::vector<std::uint64_t> blocks;
+    std::string pool;
+    hashes.reserve(order.size());
+    blocks.reserve(order.size() / block_size + 1);
+    std::string_view previous;
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        auto [hash, name] = names[order[i]];
+        std::size_t shared = 0;
+        if (i % block_size == 0) {
+            blocks.push_back(pool.size());
+        } else {
+            auto limit = std::min(name.size(), previous.size());
+            while (shared < limit && name[shared] == previous[shared]) {
+                ++shared;
+            }
+        }
+        put_varint(pool, shared);
+        put_varint(pool, name.size() - shared);
+        pool.append(name.substr(shared));
+        hashes.push_back(hash);
+        previous = name;
+    }
+
+    file_index index;
+    index.build(hashes);
+
+    dictionary_header hdr{};
+    hdr.magic = g_dictionary_magic;
+    hdr.version = g_dictionary_version;
+    hdr.block_size = block_size;
+
+    std::uint64_t size = sizeof(dictionary_header);
+    auto place = [&size](std::uint64_t section_size) {
+        auto at = (size + g_dictionary_alignment - 1) / g_dictionary_alignment * g_dictionary_alignment;
+        size = at + section_size;
+        return at;
+    };
+    hdr.num_names = hashes.size();
+    hdr.num_indexed = index.hashes().size();
+    hdr.hashes_offset = place(hdr.num_indexed * sizeof(std::uint64_t));
+    hdr.positions_offset = place(hdr.num_indexed * sizeof(std::uint32_t));
+    hdr.num_buckets = index.buckets().size();
+    hdr.buckets_offset = place(hdr.num_buckets * sizeof(std::uint32_t));
+    hdr.bucket_shift = index.bucket_shift();
+    hdr.num_blocks = blocks.size();
+    hdr.blocks_offset = place(blocks.size() * sizeof(std::uint64_t));
+    hdr.pool_size = pool.size();
+    hdr.pool_offset = place(pool.size());
+    hdr.total_size = size;
+
+    std::string buffer(size, '\0');
+    auto put = [&buffer](std::uint64_t at, const void *data, std::size_t data_size) {
+        if (data_size != 0) {
+            std::memcpy(buffer.data() + at, data, data_size);
+        }
+    };
+    put(0, &hdr, sizeof(hdr));
+    put(hdr.hashes_offset, index.hashes().data(), index.hashes().size() * sizeof(std::uint64_t));
+    put(hdr.positions_offset, index.positions().data(), index.positions().size() * sizeof(std::uint32_t));
+    put(hdr.buckets_offset, index.buckets().data(), index.buckets().size() * sizeof(std::uint32_t));
+    put(hdr.blocks_offset, blocks.data(), blocks.size() * sizeof(std::uint64_t));
+    put(hdr.pool_offset, pool.data(), pool.size());
+    return buffer;
+}
+
+bool dictionary::write(const std::string &path, span<const std::pair<std::uint64_t, std::string_view>> names) {
+    auto buffer = compile(names, true);
+
+    // Written next to the final path and renamed over it, so concurrent
+    // readers only ever see a complete dictionary.
+    std::error_code ec;
+    auto tmp_path = fmt::format("{}.{}.tmp", path, std::chrono::steady_clock::now().time_since_epoch().count());
+    {
+        std::ofstream out(tmp_path, std::ios::binary);
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        if (!out) {
+            out.close();
+            std::filesystem::remove(tmp_path, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+bool dictionary::assign(byte_span data) {
+    if (data.size() < sizeof(dictionary_header)) {
+        return false;
+    }
+
+    auto hdr = reinterpret_cast<const dictionary_header *>(data.data());
+    if (hdr->magic != g_dictionary_magic || hdr->version != g_dictionary_version ||
+        hdr->block_size == 0 || hdr->block_size > g_dictionary_block_size || hdr->total_size != data.size()) {
+        return false;
+    }
+
+    auto fits = [&data](std::uint64_t offset, std::uint64_t count, std::uint64_t element_size) {
+        return offset % g_dictionary_alignment == 0 && offset <= data.size() &&
+               count <= (data.size() - offset) / element_size;
+    };
+    if (!fits(hdr->hashes_offset, hdr->num_indexed, sizeof(std::uint64_t)) ||
+        !fits(hdr->positions_offset, hdr->num_indexed, sizeof(std::uint32_t)) ||
+        !fits(hdr->buckets_offset, hdr->num_buckets, sizeof(std::uint32_t)) ||
+        !fits(hdr->blocks_offset, hdr->num_blocks, sizeof(std::uint64_t)) ||
+        !fits(hdr->pool_offset, hdr->pool_size, 1)) {
+        return false;
+    }
+    if (hdr->bucket_shift < 40 || hdr->bucket_shift > 64 ||
+        hdr->num_buckets != (std::uint64_t{1} << (64 - hdr->bucket_shift)) + 1 ||
+        hdr->num_indexed > hdr->num_names ||
+        hdr->num_blocks != (hdr->num_names + hdr->block_size - 1) / hdr->block_size) {
+        return false;
+    }
+
+    auto section = [&data](std::uint64_t offset) {
+        return data.data() + offset;
+    };
+    m_index.assign(span<const std::uint64_t>(reinterpret_cast<const std::uint64_t *>(section(hdr->hashes_offset)), hdr->num_indexed),
+                   span<const std::uint32_t>(reinterpret_cast<const std::uint32_t *>(section(hdr->positions_offset)), hdr->num_indexed),
+                   span<const std::uint32_t>(reinterpret_cast<const std::uint32_t *>(section(hdr->buckets_offset)), hdr->num_buckets),
+                   hdr->bucket_shift);
+    m_blocks = span<const std::uint64_t>(reinterpret_cast<const std::uint64_t *>(section(hdr->blocks_offset)), hdr->num_blocks);
+    m_pool = byte_span(section(hdr->pool_offset), hdr->pool_size);
+    m_header = hdr;
+    return true;
+}
+
+bool dictionary::is_open() const {
+    return m_header != nullptr;
+}
+
+std::size_t dictionary::size() const {
+    return m_header == nullptr ? 0 : m_header->num_indexed;
+}
+
+bool dictionary::contains(std::uint64_t hash) const {
+    return m_header != nullptr && m_index.find(hash) != file_index::npos;
+}
+
+std::optional<std::string> dictionary::find(std::uint64_t hash) const {
+    if (m_header == nullptr) {
+        return std::nullopt;
+    }
+    auto id = m_index.find(hash);
+    if (id == file_index::npos || id >= m_header->num_names) {
+        return std::nullopt;
+    }
+
+    // Names are rebuilt from the start of their block.
+    std::string name;
+    auto block_size = m_header->block_size;
+    auto at = m_blocks[id / block_size];
+    for (auto i = id - id % block_size; i <= id; ++i) {
+        std::uint64_t shared = 0;
+        std::uint64_t rest = 0;
+        if (!get_varint(m_pool, at, shared) || !get_varint(m_pool, at, rest) ||
+            shared > name.size() || rest > m_pool.size() - at) {
+            return std::nullopt;
+        }
+        name.resize(shared);
+        name.append(m_pool.data() + at, rest);
+        at += rest;
+    }
+    return name;
+}
+
+}// namespace rdar
@@ -0,0 +1,59 @@
+#pragma once
+#include "file_index.h"
+#include "mapped_file.h"
+#include "span.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace rdar {
+
+struct dictionary_header;
+
+// Names of path hashes, compiled from a hashes.csv list. Hashes are indexed
+// like archive entries; the names are kept in a pool, front-coded in blocks
+// when compiled ahead of time, and a name is only decoded when asked for. A compiled dictionary is used
+// straight from its mapping, so processes share it through the page cache.
+class dictionary {
+    std::unique_ptr<mapped_file> m_file;
+    // A hashes.csv list compiled in memory.
+    std::string m_storage;
+    const dictionary_header *m_header = nullptr;
+    file_index m_index;
+    span<const std::uint64_t> m_blocks;
+    byte_span m_pool;
+
+public:
+    // Opens a compiled dictionary, or compiles a hashes.csv list in memory,
+    // parsing it on up to threads threads.
+    explicit dictionary(const std::string &path, std::size_t threads = 1);
+    // As above, but a hashes.csv list only keeps the names of hashes in the
+    // index, so an archive's names cost memory in proportion to the archive.
+    dictionary(const std::string &path, std::size_t threads, const file_index &only);
+
+    dictionary(const dictionary &) = delete;
+    dictionary &operator=(const dictionary &) = delete;
+
+    // Compiles names listed with their hashes; where a hash is listed again
+    // its last name wins. With front_code the names are sorted to share their
+    // prefixes, which makes the dictionary much smaller but takes a while.
+    [[nodiscard]] static std::string compile(span<const std::pair<std::uint64_t, std::string_view>> names, bool front_code);
+    // Writes a front-coded dictionary atomically; returns false if it could
+    // not be written.
+    [[nodiscard]] static bool write(const std::string &path, span<const std::pair<std::uint64_t, std::string_view>> names);
+
+    [[nodiscard]] bool is_open() const;
+    [[nodiscard]] std::size_t size() const;
+    [[nodiscard]] bool contains(std::uint64_t hash) const;
+    [[nodiscard]] std::optional<std::string> find(std::uint64_t hash) const;
+
+private:
+    [[nodiscard]] bool assign(byte_span data);
+    void compile_list(const std::vector<std::pair<std::uint64_t, std::string_view>> &names);
+};
+
+}// namespace rdar
@@ -0,0 +1,151 @@
+#include "directory_cache.h"
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace rdar {
+
+std::optional<std::string> relative_output_path(std::string_view path) {
+    auto first = path.find_first_not_of('/');
+    if (first == std::string_view::npos) {
+        return std::nullopt;
+    }
+    path.remove_prefix(first);
+
+    for (std::size_t begin = 0;;) {
+        auto end = path.find('/', begin);
+        auto component = path.substr(begin, end == std::string_view::npos ? std::string_view::npos : end - begin);
+        if (component.empty() || component == "." || component == "..") {
+            return std::nullopt;
+        }
+#ifdef _WIN32
+        // Drive letters and alternate data streams.
+        if (component.find(':') != std::string_view::npos) {
+            return std::nullopt;
+        }
+#endif
+        if (end == std::string_view::npos) {
+            break;
+        }
+        begin = end + 1;
+    }
+    return std::string(path);
+}
+
+directory_cache::directory_cache(std::string root, std::size_t max_open) : m_root(std::move(root)), m_max_open(max_open) {
+    if (m_root.empty()) {
+        throw std::runtime_error("base_path cannot be empty");
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(m_root, ec);
+#ifndef _WIN32
+    m_root_fd = ::open(m_root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (m_root_fd < 0) {
+        throw std::runtime_error("could not open output directory");
+    }
+#endif
+}
+
+directory_cache::~directory_cache() {
+#ifndef _WIN32
+    for (auto &[dir, fd] : m_dirs) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    ::close(m_root_fd);
+#endif
+}
+
+std::optional<output_location> directory_cache::locate(std::string_view raw_path) {
+    auto relative = relative_output_path(raw_path);
+    if (!relative) {
+        return std::nullopt;
+    }
+    std::string_view path = *relative;
+
+    auto slash = path.find_last_of('/');
+    if (slash == std::string_view::npos) {
+#ifdef _WIN32
+        return output_location{-1, m_root + '/' + std::string(path)};
+#else
+        return output_location{m_root_fd, std::string(path)};
+#endif
+    }
+
+    auto dir = path.substr(0, slash);
+    bool found = false;
+    auto fd = find(dir, found);
+    if (!found) {
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        fd = create(std::string(dir));
+    }
+
+#ifdef _WIN32
+    return output_location{-1, m_root + '/' + std::string(path)};
+#else
+    if (fd < 0) {
+        return output_location{m_root_fd, std::string(path)};
+    }
+    return output_location{fd, std::string(path.substr(slash + 1))};
+#endif
+}
+
+int directory_cache::find(std::string_view dir, bool &found) const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    auto at = m_dirs.find(std::string(dir));
+    found = at != m_dirs.end();
+    return found ? at->second : -1;
+}
+
+// Called with the lock held exclusively.
+int directory_cache::create(const std::string &dir) {
+    auto at = m_dirs.find(dir);
+    if (at != m_dirs.end()) {
+        return at->second;
+    }
+
+#ifdef _WIN32
+    std::error_code ec;
+    std::filesystem::create_directories(m_root + '/' + dir, ec);
+    m_dirs.emplace(dir, -1);
+    return -1;
+#else
+    // Parents come first, so every directory is made relative to its parent.
+    auto slash = dir.find_last_of('/');
+    int parent_fd = m_root_fd;
+    std::string leaf = dir;
+    if (slash != std::string::npos) {
+        parent_fd = create(dir.substr(0, slash));
+        if (parent_fd < 0) {
+            parent_fd = m_root_fd;
+        } else {
+            leaf = dir.substr(slash + 1);
+        }
+    }
+
+    // A failure here surfaces when the file itself is opened.
+    if (::mkdirat(parent_fd, leaf.c_str(), 0755) != 0 && errno != EEXIST) {
+        return -1;
+    }
+
+    int fd = -1;
+    if (m_open < m_max_open) {
+        fd = ::openat(parent_fd, leaf.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            ++m_open;
+        }
+    }
+    m_dirs.emplace(dir, fd);
+    return fd;
+#endif
+}
+
+}// namespace rdar
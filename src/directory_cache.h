@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace rdar {
+
+// Where to open an output file: a name relative to a directory descriptor.
+// Without descriptor support dir_fd is -1 and name is a full path.
+struct output_location {
+    int dir_fd;
+    std::string name;
+};
+
+// A '/'-separated path made safe to resolve below an output root: leading
+// separators are dropped, and paths with empty, "." or ".." components are
+// rejected.
+[[nodiscard]] std::optional<std::string> relative_output_path(std::string_view path);
+
+// Creates the directories below an output root once and keeps descriptors
+// of them open, so files are opened relative to their directory instead of
+// by full path. Past a descriptor limit directories are still remembered as
+// created, and their files are opened relative to the root.
+class directory_cache {
+    std::string m_root;
+    int m_root_fd = -1;
+    std::size_t m_max_open;
+    std::size_t m_open = 0;
+    // Relative directory -> descriptor, or -1 once the limit is reached.
+    std::unordered_map<std::string, int> m_dirs;
+    mutable std::shared_mutex m_mutex;
+
+public:
+    explicit directory_cache(std::string root, std::size_t max_open = 512);
+    ~directory_cache();
+
+    directory_cache(const directory_cache &) = delete;
+    directory_cache &operator=(const directory_cache &) = delete;
+
+    // Resolves a '/'-separated path relative to the root, creating its
+    // directories if needed. Paths that would leave the root are rejected.
+    [[nodiscard]] std::optional<output_location> locate(std::string_view path);
+
+private:
+    [[nodiscard]] int find(std::string_view dir, bool &found) const;
+    int create(const std::string &dir);
+};
+
+}// namespace rdar
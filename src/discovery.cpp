@@ -0,0 +1,204 @@
+#include "discovery.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "util.h"
+#include <algorithm>
+#include <charconv>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+namespace rdar {
+
+// Combinations of the outer choices per task; enough tasks to keep every
+// thread busy when their inner choices differ in cost.
+constexpr std::size_t g_discovery_tasks_per_thread = 64;
+
+namespace {
+
+std::vector<std::string> number_range(std::string_view range) {
+    auto dash = range.find('-');
+    if (dash == std::string_view::npos || dash == 0) {
+        throw std::runtime_error("invalid number range in pattern");
+    }
+    auto first_part = range.substr(0, dash);
+    auto last_part = range.substr(dash + 1);
+    std::uint64_t first = 0;
+    std::uint64_t last = 0;
+    if (std::from_chars(first_part.data(), first_part.data() + first_part.size(), first).ptr != first_part.data() + first_part.size() ||
+        std::from_chars(last_part.data(), last_part.data() + last_part.size(), last).ptr != last_part.data() + last_part.size() ||
+        last < first) {
+        throw std::runtime_error("invalid number range in pattern");
+    }
+
+    std::vector<std::string> numbers;
+    numbers.reserve(last - first + 1);
+    for (auto n = first; n <= last; ++n) {
+        auto digits = std::to_string(n);
+        if (digits.size() < first_part.size()) {
+            digits.insert(0, first_part.size() - digits.size(), '0');
+        }
+        numbers.push_back(std::move(digits));
+    }
+    return numbers;
+}
+
+}// namespace
+
+path_template::path_template(const std::string &pattern, std::vector<std::vector<std::string>> word_lists) {
+    std::size_t next_list = 0;
+    std::string literal;
+    for (std::size_t at = 0; at < pattern.size(); ++at) {
+        if (pattern[at] != '{') {
+            literal.push_back(pattern[at]);
+            continue;
+        }
+        auto close = pattern.find('}', at);
+        if (close == std::string::npos) {
+            throw std::runtime_error("unbalanced braces in pattern");
+        }
+        auto inside = std::string_view(pattern).substr(at + 1, close - at - 1);
+        if (inside.empty()) {
+            if (next_list >= word_lists.size()) {
+                throw std::runtime_error("not enough word lists for pattern");
+            }
+            m_choices.push_back(std::move(word_lists[next_list++]));
+        } else {
+            m_choices.push_back(number_range(inside));
+        }
+        m_literals.push_back(std::move(literal));
+        literal.clear();
+        at = close;
+    }
+    m_literals.push_back(std::move(literal));
+}
+
+const std::vector<std::string> &path_template::literals() const {
+    return m_literals;
+}
+
+const std::vector<std::vector<std::string>> &path_template::choices() const {
+    return m_choices;
+}
+
+std::uint64_t path_template::size() const {
+    std::uint64_t count = 1;
+    for (auto &choice : m_choices) {
+        if (!choice.empty() && count > std::numeric_limits<std::uint64_t>::max() / choice.size()) {
+            throw std::runtime_error("too many candidate paths");
+        }
+        count *= choice.size();
+    }
+    return count;
+}
+
+std::vector<std::string> read_word_list(const std::string &path) {
+    mapped_file file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("could not open word list");
+    }
+
+    std::vector<std::string> words;
+    std::string_view text(file.data().data(), file.data().size());
+    while (!text.empty()) {
+        auto end = text.find('\n');
+        auto word = text.substr(0, end);
+        text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+        if (!word.empty() && word.back() == '\r') {
+            word.remove_suffix(1);
+        }
+        if (!word.empty()) {
+            words.emplace_back(word);
+        }
+    }
+    return words;
+}
+
+std::vector<discovered_path> discover(const path_template &pattern, const hash_filter &targets, std::size_t threads) {
+    auto &literals = pattern.literals();
+    auto &choices = pattern.choices();
+    std::vector<discovered_path> found;
+    if (pattern.size() == 0) {
+        return found;
+    }
+    if (choices.empty()) {
+        auto hash = fnv1a64(literals.front());
+        if (targets.contains(hash)) {
+            found.push_back(discovered_path{hash, literals.front()});
+        }
+        return found;
+    }
+
+    // The last choice is hashed in lanes for every combination of the others,
+    // each continuing from the cached hash of the path before it.
+    auto outer_levels = choices.size() - 1;
+    std::uint64_t outer = 1;
+    for (std::size_t level = 0; level < outer_levels; ++level) {
+        outer *= choices[level].size();
+    }
+    auto &inner = choices.back();
+    std::vector<std::string_view> inner_words(inner.begin(), inner.end());
+    auto &suffix = literals.back();
+
+    auto tasks = static_cast<std::size_t>(std::min<std::uint64_t>(outer, threads * g_discovery_tasks_per_thread));
+    std::mutex found_mutex;
+    thread_pool(threads).run_in_order(tasks, [&](std::size_t, std::size_t task) {
+        auto begin = outer * task / tasks;
+        auto end = outer * (task + 1) / tasks;
+
+        // Like an odometer, the last outer choice turns fastest.
+        std::vector<std::size_t> digits(outer_levels);
+        auto rest = begin;
+        for (auto level = outer_levels; level-- > 0;) {
+            digits[level] = static_cast<std::size_t>(rest % choices[level].size());
+            rest /= choices[level].size();
+        }
+        // states[i] is the hash of the path up to outer choice i.
+        std::vector<std::uint64_t> states(outer_levels + 1, g_fnv_offset_basis);
+        auto refresh = [&](std::size_t from) {
+            for (auto level = from; level < outer_levels; ++level) {
+                states[level + 1] = fnv1a64(choices[level][digits[level]], fnv1a64(literals[level], states[level]));
+            }
+        };
+        refresh(0);
+
+        std::vector<std::uint64_t> hashes(inner_words.size());
+        for (auto combination = begin; combination < end; ++combination) {
+            fnv1a64_many(fnv1a64(literals[outer_levels], states[outer_levels]), inner_words, suffix, hashes);
+            for (std::size_t i = 0; i < hashes.size(); ++i) {
+                if (!targets.contains(hashes[i])) {
+                    continue;
+                }
+                std::string path;
+                for (std::size_t level = 0; level < outer_levels; ++level) {
+                    path += literals[level];
+                    path += choices[level][digits[level]];
+                }
+                path += literals[outer_levels];
+                path += inner[i];
+                path += suffix;
+                std::lock_guard<std::mutex> lock(found_mutex);
+                found.push_back(discovered_path{hashes[i], std::move(path)});
+            }
+
+            auto level = outer_levels;
+            while (level > 0) {
+                --level;
+                if (++digits[level] < choices[level].size()) {
+                    break;
+                }
+                digits[level] = 0;
+            }
+            refresh(level);
+        }
+    });
+
+    std::sort(found.begin(), found.end(), [](const discovered_path &a, const discovered_path &b) {
+        return a.path < b.path;
+    });
+    return found;
+}
+
+}// namespace rdar
@@ -0,0 +1,39 @@
+#pragma once
+#include "hash_filter.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace rdar {
+
+// A pattern for candidate paths: literal text with choices in braces. "{}"
+// takes the words of the next word list in turn and "{a-b}" the numbers from
+// a to b, zero-padded to the width of a.
+class path_template {
+    // One more literal than choices; choice i goes between literals i and i + 1.
+    std::vector<std::string> m_literals;
+    std::vector<std::vector<std::string>> m_choices;
+
+public:
+    path_template(const std::string &pattern, std::vector<std::vector<std::string>> word_lists);
+
+    [[nodiscard]] const std::vector<std::string> &literals() const;
+    [[nodiscard]] const std::vector<std::vector<std::string>> &choices() const;
+    // The number of candidate paths.
+    [[nodiscard]] std::uint64_t size() const;
+};
+
+struct discovered_path {
+    std::uint64_t hash;
+    std::string path;
+};
+
+// Reads one word per line, skipping empty lines.
+[[nodiscard]] std::vector<std::string> read_word_list(const std::string &path);
+
+// Hashes every candidate path of the pattern on up to threads threads and
+// returns the ones whose hash the targets contain, sorted by path.
+[[nodiscard]] std::vector<discovered_path> discover(const path_template &pattern, const hash_filter &targets, std::size_t threads);
+
+}// namespace rdar
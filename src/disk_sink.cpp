@@ -0,0 +1,265 @@
+#include "disk_sink.h"
+#include "util.h"
+#include <algorithm>
+#include <filesystem>
+#include <fmt/core.h>
+#include <fstream>
+#include <utility>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+namespace rdar {
+
+constexpr unsigned g_uring_depth = 256;
+constexpr std::size_t g_kernel_copy_min_size = 64 * 1024;
+// Reserving blocks up front is worth its extra call from this size on.
+constexpr std::uint64_t g_preallocate_min_size = 1024 * 1024;
+// Marks an output directory where files were hard linked.
+constexpr const char *g_links_marker = ".rdar-links";
+
+static bool has_links(const std::string &base_path) {
+    std::error_code ec;
+    return std::filesystem::exists(base_path + '/' + g_links_marker, ec);
+}
+
+disk_sink::disk_sink(std::string base_path, bool async_io, bool verbose, bool durable) : m_base_path(std::move(base_path)), m_dirs(m_base_path), m_verbose(verbose), m_durable(durable), m_unlink_first(has_links(m_base_path)) {
+    if (async_io && !durable) {
+        m_uring = uring_writer::create(g_uring_depth);
+    }
+}
+
+disk_sink::~disk_sink() {
+    flush();
+}
+
+std::optional<output_location> disk_sink::locate(std::string path) {
+    std::replace(path.begin(), path.end(), '\\', '/');
+    if (m_verbose) {
+        fmt::print("extracting {}/{}\n", m_base_path, path);
+    }
+    auto location = m_dirs.locate(path);
+    if (!location) {
+        fmt::print(stderr, "invalid output path: {}\n", path);
+        return std::nullopt;
+    }
+    if (m_unlink_first) {
+#ifdef _WIN32
+        std::error_code ec;
+        std::filesystem::remove(location->name, ec);
+#else
+        ::unlinkat(location->dir_fd, location->name.c_str(), 0);
+#endif
+    }
+    return location;
+}
+
+int disk_sink::open_file(const output_location &location, std::uint64_t size) {
+#ifdef _WIN32
+    auto fd = ::_open(location.name.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    auto fd = ::openat(location.dir_fd, location.name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+    if (fd < 0) {
+        fmt::print(stderr, "could not write file: {}\n", location.name);
+        return -1;
+    }
+#ifdef __linux__
+    // Only a hint; file systems without it still get the file.
+    if (size >= g_preallocate_min_size) {
+        static_cast<void>(::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size)));
+    }
+#endif
+    return fd;
+}
+
+bool disk_sink::close_file(int fd) {
+#ifdef _WIN32
+    auto synced = !m_durable || ::_commit(fd) == 0;
+    return ::_close(fd) == 0 && synced;
+#else
+#if defined(__linux__)
+    auto synced = !m_durable || ::fdatasync(fd) == 0;
+#else
+    auto synced = !m_durable || ::fsync(fd) == 0;
+#endif
+    return ::close(fd) == 0 && synced;
+#endif
+}
+
+bool disk_sink::fail(const std::string &path) {
+    std::lock_guard<std::mutex> lock(m_failed_mutex);
+    m_failed.insert(path);
+    return false;
+}
+
+bool disk_sink::write_file(std::string path, span<const byte_span> parts) {
+    std::uint64_t size = 0;
+    for (auto &part : parts) {
+        size += part.size();
+    }
+    auto location = locate(path);
+    if (!location) {
+        return fail(path);
+    }
+    if (m_uring && m_uring->write_file(location->dir_fd, location->name, path, parts, size >= g_preallocate_min_size)) {
+        return true;
+    }
+
+    auto fd = open_file(*location, size);
+    if (fd < 0) {
+        return fail(path);
+    }
+    bool written = true;
+    for (auto &part : parts) {
+        if (!write_all(fd, part)) {
+            fmt::print(stderr, "could not write file: {}\n", location->name);
+            written = false;
+            break;
+        }
+    }
+    if (!close_file(fd) || !written) {
+        return fail(path);
+    }
+    return true;
+}
+
+bool disk_sink::write_file(std::string path, std::string &&content) {
+    auto size = content.size();
+    auto location = locate(path);
+    if (!location) {
+        return fail(path);
+    }
+    if (m_uring && m_uring->write_file(location->dir_fd, location->name, path, std::move(content), size >= g_preallocate_min_size)) {
+        return true;
+    }
+
+    auto fd = open_file(*location, size);
+    if (fd < 0) {
+        return fail(path);
+    }
+    bool written = write_all(fd, byte_span(content.data(), content.size()));
+    if (!written) {
+        fmt::print(stderr, "could not write file: {}\n", location->name);
+    }
+    if (!close_file(fd) || !written) {
+        return fail(path);
+    }
+    return true;
+}
+
+bool disk_sink::write_file(std::string path, const mapped_file &source, span<const byte_span> parts) {
+    std::uint64_t size = 0;
+    for (auto &part : parts) {
+        size += part.size();
+    }
+    if (m_uring && size < g_kernel_copy_min_size) {
+        return write_file(std::move(path), parts);
+    }
+
+    auto location = locate(path);
+    if (!location) {
+        return fail(path);
+    }
+    auto fd = open_file(*location, size);
+    if (fd < 0) {
+        return fail(path);
+    }
+    bool written = true;
+    auto base = source.data().data();
+    for (auto &part : parts) {
+        if (!source.write_to(fd, static_cast<std::uint64_t>(part.data() - base), part.size())) {
+            fmt::print(stderr, "could not write file: {}\n", location->name);
+            written = false;
+            break;
+        }
+    }
+    if (!close_file(fd) || !written) {
+        return fail(path);
+    }
+    return true;
+}
+
+bool disk_sink::link_file(std::string path, const std::string &target, link_kind kind) {
+    auto target_path = target;
+    std::replace(target_path.begin(), target_path.end(), '\\', '/');
+    auto source = m_dirs.locate(target_path);
+    if (!source) {
+        return false;
+    }
+    auto location = locate(std::move(path));
+    if (!location) {
+        return false;
+    }
+
+#ifdef _WIN32
+    std::error_code ec;
+    std::filesystem::remove(location->name, ec);
+    std::filesystem::create_hard_link(source->name, location->name, ec);
+    if (ec) {
+        return false;
+    }
+#else
+#ifdef __linux__
+    if (kind == link_kind::reflink) {
+        auto source_fd = ::openat(source->dir_fd, source->name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (source_fd < 0) {
+            return false;
+        }
+        auto fd = ::openat(location->dir_fd, location->name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        auto cloned = fd >= 0 && ::ioctl(fd, FICLONE, source_fd) == 0;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        ::close(source_fd);
+        if (cloned) {
+            return true;
+        }
+    }
+#endif
+    ::unlinkat(location->dir_fd, location->name.c_str(), 0);
+    if (::linkat(source->dir_fd, source->name.c_str(), location->dir_fd, location->name.c_str(), 0) != 0) {
+        return false;
+    }
+#endif
+    if (!m_unlink_first.exchange(true)) {
+        std::ofstream(m_base_path + '/' + g_links_marker);
+    }
+    return true;
+}
+
+bool disk_sink::holds(std::string path, std::uint64_t size) const {
+    std::replace(path.begin(), path.end(), '\\', '/');
+    auto relative = relative_output_path(path);
+    if (!relative) {
+        return false;
+    }
+    std::error_code ec;
+    auto existing = std::filesystem::file_size(m_base_path + '/' + *relative, ec);
+    return !ec && existing == size;
+}
+
+void disk_sink::flush() {
+    if (m_uring) {
+        for (auto &path : m_uring->flush()) {
+            fail(path);
+        }
+    }
+}
+
+bool disk_sink::failed(const std::string &path) const {
+    std::lock_guard<std::mutex> lock(m_failed_mutex);
+    return m_failed.count(path) != 0;
+}
+
+}// namespace rdar
@@ -0,0 +1,66 @@
+#pragma once
+#include "directory_cache.h"
+#include "file_sink.h"
+#include "uring_writer.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_set>
+
+namespace rdar {
+
+// Writes files below a base directory, turning archive path separators into
+// directories. Directories are created once and files opened relative to
+// them; large files have their blocks reserved before they are written.
+// Where earlier runs left hard links, files are replaced instead of being
+// written through the links.
+class disk_sink : public file_sink {
+    std::string m_base_path;
+    directory_cache m_dirs;
+    std::unique_ptr<uring_writer> m_uring;
+    bool m_verbose;
+    bool m_durable;
+    // Set once the directory holds hard links, whose content must not be
+    // overwritten in place.
+    std::atomic<bool> m_unlink_first;
+    // Paths, as received, of the files that could not be written.
+    std::unordered_set<std::string> m_failed;
+    mutable std::mutex m_failed_mutex;
+
+public:
+    // With async_io, files are written through io_uring where the system
+    // supports it and synchronously otherwise. With verbose every file is
+    // printed as it is extracted. With durable every file's data is synced
+    // to disk before its write returns; io_uring is not used then, as its
+    // files only complete after the write returned.
+    explicit disk_sink(std::string base_path, bool async_io = false, bool verbose = false, bool durable = false);
+    ~disk_sink() override;
+
+    bool write_file(std::string path, span<const byte_span> parts) override;
+    bool write_file(std::string path, std::string &&content) override;
+    // Lets the kernel move the bytes. Small files still go through io_uring,
+    // where creating the file costs far more than copying it.
+    bool write_file(std::string path, const mapped_file &source, span<const byte_span> parts) override;
+    // Falls back to a hard link where the file system has no reflinks.
+    bool link_file(std::string path, const std::string &target, link_kind kind) override;
+    void flush() override;
+    // Whether the file was already written with the given size.
+    [[nodiscard]] bool holds(std::string path, std::uint64_t size) const;
+    // Files written through io_uring only count once flush has returned.
+    [[nodiscard]] bool failed(const std::string &path) const override;
+
+private:
+    // Reports the path and returns nothing if it would leave the base path.
+    [[nodiscard]] std::optional<output_location> locate(std::string path);
+    // Returns -1, having reported the failure, if the file cannot be created.
+    [[nodiscard]] int open_file(const output_location &location, std::uint64_t size);
+    // Returns false if the data may not have reached the file, or, when
+    // durable, the disk.
+    [[nodiscard]] bool close_file(int fd);
+    // Remembers the path as failed; returns false for the write to return.
+    bool fail(const std::string &path);
+};
+
+}// namespace rdar
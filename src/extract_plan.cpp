@@ -0,0 +1,67 @@
+#include "extract_plan.h"
+#include <algorithm>
+
+namespace rdar {
+
+extract_plan::extract_plan(const table &t, span<const file_meta> entries, const read_coalescer &coalescer, std::uint64_t read_ahead) : m_read_ahead(read_ahead) {
+    m_jobs.reserve(entries.size());
+    for (auto &meta : entries) {
+        extract_job job{&meta, 0, 0, 0};
+        t.check_entry(meta);
+        for (auto i = meta.m_first_sector; i < meta.m_last_sector; ++i) {
+            auto off = t.offset_at(i);
+            if (i == meta.m_first_sector) {
+                job.begin = off.m_offset;
+                job.end = off.m_offset;
+            }
+            job.end = std::max(job.end, off.m_offset + off.m_physical_size);
+            job.size += off.m_physical_size;
+        }
+        m_jobs.push_back(job);
+    }
+
+    std::stable_sort(m_jobs.begin(), m_jobs.end(), [](const extract_job &a, const extract_job &b) {
+        return a.begin < b.begin;
+    });
+
+    std::vector<byte_range> ranges(m_jobs.size());
+    std::transform(m_jobs.begin(), m_jobs.end(), ranges.begin(), [](const extract_job &job) {
+        return byte_range{job.begin, job.end};
+    });
+    m_reads = coalescer.coalesce(ranges);
+}
+
+span<const extract_job> extract_plan::jobs() const {
+    return span<const extract_job>(m_jobs.data(), m_jobs.size());
+}
+
+span<const coalesced_read> extract_plan::reads() const {
+    return span<const coalesced_read>(m_reads.data(), m_reads.size());
+}
+
+std::vector<std::uint64_t> extract_plan::costs(std::uint64_t per_file_cost) const {
+    std::vector<std::uint64_t> result(m_jobs.size());
+    std::transform(m_jobs.begin(), m_jobs.end(), result.begin(), [per_file_cost](const extract_job &job) {
+        return job.size + per_file_cost;
+    });
+    return result;
+}
+
+void extract_plan::read_ahead(const mapped_file &file, std::size_t job) {
+    // Whoever holds the lock is already advancing the window.
+    std::unique_lock<std::mutex> lock(m_read_ahead_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return;
+    }
+
+    auto limit = m_jobs[job].begin + m_read_ahead;
+    for (; m_read_ahead_read < m_reads.size() && m_reads[m_read_ahead_read].begin < limit; ++m_read_ahead_read) {
+        auto &ahead = m_reads[m_read_ahead_read];
+        if (ahead.last <= job) {
+            continue;
+        }
+        file.will_need(ahead.begin, ahead.end - ahead.begin);
+    }
+}
+
+}// namespace rdar
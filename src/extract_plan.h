@@ -0,0 +1,39 @@
+#pragma once
+#include "archive.h"
+#include "read_coalescer.h"
+#include <mutex>
+
+namespace rdar {
+
+// A file to extract, placed by the physical range its segments occupy.
+struct extract_job {
+    const file_meta *meta;
+    std::uint64_t begin;
+    std::uint64_t end;
+    std::uint64_t size;
+};
+
+// Orders extraction work by the offset of each file's first segment, so that
+// the archive is read front to back however many workers write the output.
+// Neighbouring files are grouped into coalesced reads, which are what the
+// read-ahead is issued for; each job then takes its slice of the mapping.
+class extract_plan {
+    std::vector<extract_job> m_jobs;
+    std::vector<coalesced_read> m_reads;
+    std::uint64_t m_read_ahead;
+    std::mutex m_read_ahead_mutex;
+    std::size_t m_read_ahead_read = 0;
+
+public:
+    extract_plan(const table &t, span<const file_meta> entries, const read_coalescer &coalescer, std::uint64_t read_ahead);
+
+    [[nodiscard]] span<const extract_job> jobs() const;
+    [[nodiscard]] span<const coalesced_read> reads() const;
+    // Payload bytes of every job, plus a fixed cost per file.
+    [[nodiscard]] std::vector<std::uint64_t> costs(std::uint64_t per_file_cost) const;
+    // Issues read-ahead, in ascending order, for the coalesced reads that start
+    // within the read-ahead window following the given job.
+    void read_ahead(const mapped_file &file, std::size_t job);
+};
+
+}// namespace rdar
@@ -0,0 +1,128 @@
+#include "file_index.h"
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+namespace rdar {
+
+file_index::file_index(file_index &&other) noexcept {
+    *this = std::move(other);
+}
+
+file_index &file_index::operator=(file_index &&other) noexcept {
+    if (this == &other) {
+        return *this;
+    }
+    // Moved vectors keep their buffers, so spans into them stay valid.
+    m_hash_storage = std::move(other.m_hash_storage);
+    m_position_storage = std::move(other.m_position_storage);
+    m_bucket_storage = std::move(other.m_bucket_storage);
+    m_hashes = std::exchange(other.m_hashes, {});
+    m_positions = std::exchange(other.m_positions, {});
+    m_buckets = std::exchange(other.m_buckets, {});
+    m_bucket_shift = std::exchange(other.m_bucket_shift, 64);
+    other.m_hash_storage.clear();
+    other.m_position_storage.clear();
+    other.m_bucket_storage.clear();
+    return *this;
+}
+
+void file_index::build(const std::vector<std::uint64_t> &hashes) {
+    std::vector<std::uint32_t> order(hashes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&hashes](std::uint32_t a, std::uint32_t b) {
+        return hashes[a] < hashes[b];
+    });
+
+    m_hash_storage.clear();
+    m_position_storage.clear();
+    m_hash_storage.reserve(order.size());
+    m_position_storage.reserve(order.size());
+    for (auto position : order) {
+        if (!m_hash_storage.empty() && m_hash_storage.back() == hashes[position]) {
+            m_position_storage.back() = position;
+            continue;
+        }
+        m_hash_storage.push_back(hashes[position]);
+        m_position_storage.push_back(position);
+    }
+
+    std::uint32_t bucket_bits = 0;
+    while (bucket_bits < 24 && (std::size_t{1} << bucket_bits) < m_hash_storage.size()) {
+        ++bucket_bits;
+    }
+    m_bucket_shift = 64 - bucket_bits;
+
+    m_bucket_storage.assign((std::size_t{1} << bucket_bits) + 1, 0);
+    std::size_t at = 0;
+    for (std::size_t bucket = 0; bucket + 1 < m_bucket_storage.size(); ++bucket) {
+        m_bucket_storage[bucket] = static_cast<std::uint32_t>(at);
+        while (at < m_hash_storage.size() && (bucket_bits == 0 || (m_hash_storage[at] >> m_bucket_shift) == bucket)) {
+            ++at;
+        }
+    }
+    m_bucket_storage.back() = static_cast<std::uint32_t>(m_hash_storage.size());
+
+    m_hashes = m_hash_storage;
+    m_positions = m_position_storage;
+    m_buckets = m_bucket_storage;
+}
+
+void file_index::assign(span<const std::uint64_t> hashes, span<const std::uint32_t> positions, span<const std::uint32_t> buckets, std::uint32_t bucket_shift) {
+    m_hash_storage.clear();
+    m_position_storage.clear();
+    m_bucket_storage.clear();
+
+    m_hashes = hashes;
+    m_positions = positions;
+    m_buckets = buckets;
+    m_bucket_shift = bucket_shift;
+}
+
+std::uint32_t file_index::find(std::uint64_t hash) const {
+    if (m_hashes.empty()) {
+        return npos;
+    }
+    auto bucket = m_bucket_shift == 64 ? 0 : hash >> m_bucket_shift;
+    auto begin = m_hashes.begin() + m_buckets[bucket];
+    auto end = m_hashes.begin() + m_buckets[bucket + 1];
+    auto at = std::lower_bound(begin, end, hash);
+    if (at == end || *at != hash) {
+        return npos;
+    }
+    return m_positions[at - m_hashes.begin()];
+}
+
+void file_index::find_many(span<const std::uint64_t> hashes, span<std::uint32_t> out) const {
+    std::vector<std::uint32_t> order(hashes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&hashes](std::uint32_t a, std::uint32_t b) {
+        return hashes[a] < hashes[b];
+    });
+
+    for (auto query : order) {
+        out[query] = find(hashes[query]);
+    }
+}
+
+std::size_t file_index::size() const {
+    return m_hashes.size();
+}
+
+span<const std::uint64_t> file_index::hashes() const {
+    return m_hashes;
+}
+
+span<const std::uint32_t> file_index::positions() const {
+    return m_positions;
+}
+
+span<const std::uint32_t> file_index::buckets() const {
+    return m_buckets;
+}
+
+std::uint32_t file_index::bucket_shift() const {
+    return m_bucket_shift;
+}
+
+}// namespace rdar
@@ -0,0 +1,48 @@
+#pragma once
+#include "span.h"
+#include <cstdint>
+#include <vector>
+
+namespace rdar {
+
+// Maps entry hashes to their position in the table. Hashes are kept sorted in
+// one contiguous array and bucketed by their top bits, so a lookup touches one
+// bucket pair and, on average, a single hash.
+class file_index {
+    std::vector<std::uint64_t> m_hash_storage;
+    std::vector<std::uint32_t> m_position_storage;
+    std::vector<std::uint32_t> m_bucket_storage;
+
+    span<const std::uint64_t> m_hashes;
+    span<const std::uint32_t> m_positions;
+    span<const std::uint32_t> m_buckets;
+    std::uint32_t m_bucket_shift = 64;
+
+public:
+    static constexpr std::uint32_t npos = ~std::uint32_t{0};
+
+    file_index() = default;
+    // The spans may point into the storage, which a copy would not share, so
+    // the index is only moved. A moved-from index is empty.
+    file_index(const file_index &) = delete;
+    file_index &operator=(const file_index &) = delete;
+    file_index(file_index &&other) noexcept;
+    file_index &operator=(file_index &&other) noexcept;
+
+    // Builds the index from hashes in table order. Later duplicates win.
+    void build(const std::vector<std::uint64_t> &hashes);
+    // Uses an index built earlier, e.g. one stored in an index cache.
+    void assign(span<const std::uint64_t> hashes, span<const std::uint32_t> positions, span<const std::uint32_t> buckets, std::uint32_t bucket_shift);
+
+    [[nodiscard]] std::uint32_t find(std::uint64_t hash) const;
+    // Resolves many hashes at once, visiting the index in ascending hash order.
+    void find_many(span<const std::uint64_t> hashes, span<std::uint32_t> out) const;
+    [[nodiscard]] std::size_t size() const;
+
+    [[nodiscard]] span<const std::uint64_t> hashes() const;
+    [[nodiscard]] span<const std::uint32_t> positions() const;
+    [[nodiscard]] span<const std::uint32_t> buckets() const;
+    [[nodiscard]] std::uint32_t bucket_shift() const;
+};
+
+}// namespace rdar
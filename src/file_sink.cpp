@@ -1,27 +1,26 @@
 #include "file_sink.h"
-#include <fmt/core.h>
-#include <algorithm>
-#include <filesystem>
 #include <utility>
 
 namespace rdar {
 
-file_sink::file_sink(std::string base_path) : m_base_path(std::move(base_path)) {
-    if (m_base_path.empty()) {
-        throw std::runtime_error("base_path cannot be empty");
-    }
+bool file_sink::write_file(std::string path, std::string &&content) {
+    byte_span part(content.data(), content.size());
+    return write_file(std::move(path), span<const byte_span>(&part, 1));
 }
 
-std::ofstream file_sink::new_stream(std::string path) {
-    std::replace(path.begin(), path.end(), '\\', '/');
-    auto full_path = m_base_path + '/' + path;
-
-    auto last_slash = full_path.find_last_of('/');
-    std::filesystem::create_directories(full_path.substr(0, last_slash));
+bool file_sink::write_file(std::string path, const mapped_file &, span<const byte_span> parts) {
+    return write_file(std::move(path), parts);
+}
 
-    fmt::print("extracting {}\n", full_path);
+bool file_sink::link_file(std::string, const std::string &, link_kind) {
+    return false;
+}
 
-    return std::ofstream(full_path);
+void file_sink::flush() {
 }
 
+bool file_sink::failed(const std::string &) const {
+    return false;
 }
+
+}// namespace rdar
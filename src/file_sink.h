@@ -1,16 +1,45 @@
 #pragma once
+#include "mapped_file.h"
+#include "span.h"
 #include <string>
-#include <vector>
-#include <fstream>
 
 namespace rdar {
 
+// How a file is made to share the content of another: as a hard link to the
+// same inode, or as a reflink sharing its blocks, where the file system
+// supports them, and a hard link elsewhere.
+enum class link_kind {
+    hard,
+    reflink,
+};
+
+// Receives extracted files. Extraction may call write_file from several
+// threads at once, with paths as stored in the archive. write_file returns
+// false if the file could not be written; a sink that finishes files after
+// returning may only find out by the time flush returns.
 class file_sink {
-    std::string m_base_path;
 public:
-    explicit file_sink(std::string base_path);
+    virtual ~file_sink() = default;
 
-    [[nodiscard]] std::ofstream new_stream(std::string path);
+    // Receives a whole file from consecutive parts. The parts stay valid
+    // until flush returns.
+    virtual bool write_file(std::string path, span<const byte_span> parts) = 0;
+    // Receives a whole file the sink may keep. By default it is passed on as
+    // a single part, so sinks holding on to parts past the call override it.
+    virtual bool write_file(std::string path, std::string &&content);
+    // Receives a file whose parts are views into source, for sinks that can
+    // copy from the file itself. By default the parts are passed on as is.
+    virtual bool write_file(std::string path, const mapped_file &source, span<const byte_span> parts);
+    // Makes path share the content of target, a complete file received
+    // earlier, without writing it again. Returns false if the sink cannot,
+    // which it does by default; the file is then written as usual.
+    virtual bool link_file(std::string path, const std::string &target, link_kind kind);
+    // Waits for every file received so far to be complete.
+    virtual void flush();
+    // Whether writing the file failed, counting files that only failed by
+    // the time flush returned. By default sinks have nothing to add to what
+    // write_file returned.
+    [[nodiscard]] virtual bool failed(const std::string &path) const;
 };
 
-}
+}// namespace rdar
@@ -0,0 +1,18 @@
+#include "hash_filter.h"
+
+namespace rdar {
+
+hash_filter::hash_filter(const file_index &index) : m_index(index) {
+    std::uint32_t bits = 6;
+    while (bits < 40 && (std::uint64_t{1} << bits) < index.size() * 16) {
+        ++bits;
+    }
+    m_bitmap.resize(std::size_t{1} << (bits - 6));
+    m_shift = 64 - bits;
+    for (auto hash : index.hashes()) {
+        auto bit = hash >> m_shift;
+        m_bitmap[bit >> 6] |= std::uint64_t{1} << (bit & 63);
+    }
+}
+
+}// namespace rdar
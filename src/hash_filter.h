@@ -0,0 +1,25 @@
+#pragma once
+#include "file_index.h"
+#include <cstdint>
+#include <vector>
+
+namespace rdar {
+
+// Tests many hashes, most of them absent, for membership in an index. A
+// bitmap of the indexed hashes, with about 16 bits for each, turns nearly all
+// absent ones away before the index is searched.
+class hash_filter {
+    const file_index &m_index;
+    std::vector<std::uint64_t> m_bitmap;
+    std::uint32_t m_shift;
+
+public:
+    explicit hash_filter(const file_index &index);
+
+    [[nodiscard]] bool contains(std::uint64_t hash) const {
+        auto bit = hash >> m_shift;
+        return (m_bitmap[bit >> 6] >> (bit & 63) & 1) != 0 && m_index.find(hash) != file_index::npos;
+    }
+};
+
+}// namespace rdar
@@ -0,0 +1,306 @@
+#include "index_cache.h"
+#include "util.h"
+#include <chrono>
+#include <filesystem>
+#include <fmt/core.h>
+#include <fstream>
+#include <limits>
+#include <type_traits>
+
+namespace rdar {
+
+constexpr auto g_index_cache_magic = std::array<char, 8>{'R', 'D', 'A', 'R', 'I', 'D', 'X', '\0'};
+constexpr std::uint32_t g_index_cache_version = 1;
+constexpr std::uint64_t g_index_cache_alignment = 8;
+
+static_assert(std::is_trivially_copyable_v<file_meta>, "file_meta is stored verbatim in the index cache");
+static_assert(std::is_trivially_copyable_v<offset>, "offset is stored verbatim in the index cache");
+
+struct index_cache_header {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint16_t file_meta_size;
+    std::uint16_t offset_size;
+
+    std::uint64_t archive_size;
+    std::int64_t archive_mtime;
+    std::uint64_t table_checksum;
+    std::uint64_t dictionary_size;
+    std::int64_t dictionary_mtime;
+    std::uint64_t path_offset;
+    std::uint64_t path_size;
+
+    std::uint64_t entries_offset;
+    std::uint64_t num_entries;
+    std::uint64_t offsets_offset;
+    std::uint64_t num_offsets;
+    std::uint64_t dependencies_offset;
+    std::uint64_t num_dependencies;
+    std::uint64_t index_hashes_offset;
+    std::uint64_t index_positions_offset;
+    std::uint64_t num_indexed;
+    std::uint64_t index_buckets_offset;
+    std::uint64_t num_buckets;
+    std::uint32_t index_bucket_shift;
+    std::uint32_t reserved;
+    std::uint64_t name_offsets_offset;
+    std::uint64_t num_name_offsets;
+    std::uint64_t name_pool_offset;
+    std::uint64_t name_pool_size;
+
+    std::uint64_t total_size;
+};
+
+static std::uint64_t file_size_or_zero(const std::string &path) {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(path, ec);
+    if (ec) {
+        return 0;
+    }
+    return size;
+}
+
+index_cache_key make_index_cache_key(const std::string &archive_path, const mapped_file &archive_file, const std::string &dictionary_path) {
+    index_cache_key key;
+    std::error_code ec;
+    auto absolute_path = std::filesystem::absolute(archive_path, ec);
+    key.archive_path = ec ? archive_path : absolute_path.lexically_normal().string();
+    key.archive_size = archive_file.size();
+    key.archive_mtime = file_mtime(archive_path);
+    key.dictionary_size = file_size_or_zero(dictionary_path);
+    key.dictionary_mtime = file_mtime(dictionary_path);
+
+    // The checksum is the third field of the table header.
+    reader r(archive_file.data());
+    header h;
+    h.deserialize(r);
+    r.seek(h.table_offset());
+    static_cast<void>(r.read<std::uint32_t>());
+    static_cast<void>(r.read<std::uint32_t>());
+    key.table_checksum = r.read<std::uint64_t>();
+    return key;
+}
+
+index_cache::index_cache(const std::string &path) : m_file(path) {
+    auto data = m_file.data();
+    if (data.size() < sizeof(index_cache_header)) {
+        return;
+    }
+
+    auto hdr = reinterpret_cast<const index_cache_header *>(data.data());
+    if (hdr->magic != g_index_cache_magic || hdr->version != g_index_cache_version ||
+        hdr->file_meta_size != sizeof(file_meta) || hdr->offset_size != sizeof(offset) ||
+        hdr->total_size != data.size()) {
+        return;
+    }
+
+    auto fits = [&data](std::uint64_t offset, std::uint64_t count, std::uint64_t element_size) {
+        return offset % g_index_cache_alignment == 0 && offset <= data.size() &&
+               count <= (data.size() - offset) / element_size;
+    };
+    if (!fits(hdr->path_offset, hdr->path_size, 1) ||
+        !fits(hdr->entries_offset, hdr->num_entries, sizeof(file_meta)) ||
+        !fits(hdr->offsets_offset, hdr->num_offsets, sizeof(offset)) ||
+        !fits(hdr->dependencies_offset, hdr->num_dependencies, sizeof(std::uint64_t)) ||
+        !fits(hdr->index_hashes_offset, hdr->num_indexed, sizeof(std::uint64_t)) ||
+        !fits(hdr->index_positions_offset, hdr->num_indexed, sizeof(std::uint32_t)) ||
+        !fits(hdr->index_buckets_offset, hdr->num_buckets, sizeof(std::uint32_t)) ||
+        !fits(hdr->name_offsets_offset, hdr->num_name_offsets, sizeof(std::uint32_t)) ||
+        !fits(hdr->name_pool_offset, hdr->name_pool_size, 1)) {
+        return;
+    }
+    if (hdr->index_bucket_shift < 40 || hdr->index_bucket_shift > 64 ||
+        hdr->num_buckets != (std::uint64_t{1} << (64 - hdr->index_bucket_shift)) + 1 ||
+        hdr->num_name_offsets != hdr->num_entries + 1) {
+        return;
+    }
+
+    // The sections are used without further checks, so a damaged cache is
+    // rejected here and rebuilt rather than read out of bounds later.
+    auto entries = section<file_meta>(hdr->entries_offset, hdr->num_entries);
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].m_id != i) {
+            return;
+        }
+    }
+    auto hashes = section<std::uint64_t>(hdr->index_hashes_offset, hdr->num_indexed);
+    auto positions = section<std::uint32_t>(hdr->index_positions_offset, hdr->num_indexed);
+    for (std::size_t i = 0; i < hashes.size(); ++i) {
+        if (positions[i] >= hdr->num_entries || (i != 0 && hashes[i - 1] >= hashes[i])) {
+            return;
+        }
+    }
+    auto buckets = section<std::uint32_t>(hdr->index_buckets_offset, hdr->num_buckets);
+    for (std::size_t i = 0; i < buckets.size(); ++i) {
+        if ((i != 0 && buckets[i - 1] > buckets[i]) || buckets[i] > hdr->num_indexed) {
+            return;
+        }
+    }
+    if (buckets[0] != 0 || buckets[buckets.size() - 1] != hdr->num_indexed) {
+        return;
+    }
+    auto name_offsets = section<std::uint32_t>(hdr->name_offsets_offset, hdr->num_name_offsets);
+    for (std::size_t i = 0; i < name_offsets.size(); ++i) {
+        if ((i != 0 && name_offsets[i - 1] > name_offsets[i]) || name_offsets[i] > hdr->name_pool_size) {
+            return;
+        }
+    }
+
+    m_header = hdr;
+}
+
+std::string index_cache::path_for(const std::string &cache_dir, const index_cache_key &key) {
+    return fmt::format("{}/{:016x}.idx", cache_dir, fnv1a64(key.archive_path));
+}
+
+bool index_cache::write(const std::string &path, const index_cache_key &key, const table &t, const name_resolver &resolve_name) {
+    auto entries = t.file_entries();
+    auto &index = t.index();
+
+    std::string name_pool;
+    std::vector<std::uint32_t> name_offsets;
+    name_offsets.reserve(entries.size() + 1);
+    for (auto &entry : entries) {
+        name_offsets.push_back(static_cast<std::uint32_t>(name_pool.size()));
+        name_pool += resolve_name(entry);
+        if (name_pool.size() > std::numeric_limits<std::uint32_t>::max()) {
+            return false;
+        }
+    }
+    name_offsets.push_back(static_cast<std::uint32_t>(name_pool.size()));
+
+    index_cache_header hdr{};
+    hdr.magic = g_index_cache_magic;
+    hdr.version = g_index_cache_version;
+    hdr.file_meta_size = sizeof(file_meta);
+    hdr.offset_size = sizeof(offset);
+    hdr.archive_size = key.archive_size;
+    hdr.archive_mtime = key.archive_mtime;
+    hdr.table_checksum = key.table_checksum;
+    hdr.dictionary_size = key.dictionary_size;
+    hdr.dictionary_mtime = key.dictionary_mtime;
+
+    std::uint64_t size = sizeof(index_cache_header);
+    auto place = [&size](std::uint64_t section_size) {
+        auto at = (size + g_index_cache_alignment - 1) / g_index_cache_alignment * g_index_cache_alignment;
+        size = at + section_size;
+        return at;
+    };
+    hdr.path_size = key.archive_path.size();
+    hdr.path_offset = place(hdr.path_size);
+    hdr.num_entries = entries.size();
+    hdr.entries_offset = place(entries.size() * sizeof(file_meta));
+    hdr.num_offsets = t.file_offsets().size();
+    hdr.offsets_offset = place(hdr.num_offsets * sizeof(offset));
+    hdr.num_dependencies = t.dependency_hashes().size();
+    hdr.dependencies_offset = place(hdr.num_dependencies * sizeof(std::uint64_t));
+    hdr.num_indexed = index.hashes().size();
+    hdr.index_hashes_offset = place(hdr.num_indexed * sizeof(std::uint64_t));
+    hdr.index_positions_offset = place(hdr.num_indexed * sizeof(std::uint32_t));
+    hdr.num_buckets = index.buckets().size();
+    hdr.index_buckets_offset = place(hdr.num_buckets * sizeof(std::uint32_t));
+    hdr.index_bucket_shift = index.bucket_shift();
+    hdr.num_name_offsets = name_offsets.size();
+    hdr.name_offsets_offset = place(name_offsets.size() * sizeof(std::uint32_t));
+    hdr.name_pool_size = name_pool.size();
+    hdr.name_pool_offset = place(name_pool.size());
+    hdr.total_size = size;
+
+    std::string buffer(size, '\0');
+    auto put = [&buffer](std::uint64_t at, const void *data, std::size_t data_size) {
+        if (data_size != 0) {
+            std::memcpy(buffer.data() + at, data, data_size);
+        }
+    };
+    put(0, &hdr, sizeof(hdr));
+    put(hdr.path_offset, key.archive_path.data(), key.archive_path.size());
+    put(hdr.entries_offset, entries.data(), entries.size() * sizeof(file_meta));
+    put(hdr.offsets_offset, t.file_offsets().data(), t.file_offsets().size() * sizeof(offset));
+    put(hdr.dependencies_offset, t.dependency_hashes().data(), t.dependency_hashes().size() * sizeof(std::uint64_t));
+    put(hdr.index_hashes_offset, index.hashes().data(), index.hashes().size() * sizeof(std::uint64_t));
+    put(hdr.index_positions_offset, index.positions().data(), index.positions().size() * sizeof(std::uint32_t));
+    put(hdr.index_buckets_offset, index.buckets().data(), index.buckets().size() * sizeof(std::uint32_t));
+    put(hdr.name_offsets_offset, name_offsets.data(), name_offsets.size() * sizeof(std::uint32_t));
+    put(hdr.name_pool_offset, name_pool.data(), name_pool.size());
+
+    // Written next to the final path and renamed over it, so concurrent
+    // readers only ever see a complete cache.
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    auto tmp_path = fmt::format("{}.{}.tmp", path, std::chrono::steady_clock::now().time_since_epoch().count());
+    {
+        std::ofstream out(tmp_path, std::ios::binary);
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        if (!out) {
+            out.close();
+            std::filesystem::remove(tmp_path, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+bool index_cache::matches(const index_cache_key &key) const {
+    if (m_header == nullptr) {
+        return false;
+    }
+    auto path = section<char>(m_header->path_offset, m_header->path_size);
+    return m_header->archive_size == key.archive_size &&
+           m_header->archive_mtime == key.archive_mtime &&
+           m_header->table_checksum == key.table_checksum &&
+           m_header->dictionary_size == key.dictionary_size &&
+           m_header->dictionary_mtime == key.dictionary_mtime &&
+           std::string_view(path.data(), path.size()) == key.archive_path;
+}
+
+template <typename T>
+span<const T> index_cache::section(std::uint64_t offset, std::uint64_t count) const {
+    return span<const T>(reinterpret_cast<const T *>(m_file.data().data() + offset), count);
+}
+
+std::uint64_t index_cache::table_checksum() const {
+    return m_header->table_checksum;
+}
+
+span<const file_meta> index_cache::entries() const {
+    return section<file_meta>(m_header->entries_offset, m_header->num_entries);
+}
+
+span<const offset> index_cache::offsets() const {
+    return section<offset>(m_header->offsets_offset, m_header->num_offsets);
+}
+
+span<const std::uint64_t> index_cache::dependency_hashes() const {
+    return section<std::uint64_t>(m_header->dependencies_offset, m_header->num_dependencies);
+}
+
+span<const std::uint64_t> index_cache::index_hashes() const {
+    return section<std::uint64_t>(m_header->index_hashes_offset, m_header->num_indexed);
+}
+
+span<const std::uint32_t> index_cache::index_positions() const {
+    return section<std::uint32_t>(m_header->index_positions_offset, m_header->num_indexed);
+}
+
+span<const std::uint32_t> index_cache::index_buckets() const {
+    return section<std::uint32_t>(m_header->index_buckets_offset, m_header->num_buckets);
+}
+
+std::uint32_t index_cache::index_bucket_shift() const {
+    return m_header->index_bucket_shift;
+}
+
+span<const std::uint32_t> index_cache::name_offsets() const {
+    return section<std::uint32_t>(m_header->name_offsets_offset, m_header->num_name_offsets);
+}
+
+byte_span index_cache::name_pool() const {
+    return section<char>(m_header->name_pool_offset, m_header->name_pool_size);
+}
+
+}// namespace rdar
@@ -0,0 +1,58 @@
+#pragma once
+#include "archive.h"
+#include "mapped_file.h"
+#include <functional>
+#include <string>
+
+namespace rdar {
+
+// Identifies the archive and dictionary an index cache was built from.
+struct index_cache_key {
+    std::string archive_path;
+    std::uint64_t archive_size{};
+    std::int64_t archive_mtime{};
+    std::uint64_t table_checksum{};
+    std::uint64_t dictionary_size{};
+    std::int64_t dictionary_mtime{};
+};
+
+[[nodiscard]] index_cache_key make_index_cache_key(const std::string &archive_path, const mapped_file &archive_file, const std::string &dictionary_path);
+
+struct index_cache_header;
+
+// Sidecar file holding a parsed archive table, its lookup index and the names
+// resolved for each entry. Every section is stored in its in-memory layout, so
+// a valid cache is used straight from the mapping.
+class index_cache {
+    mapped_file m_file;
+    const index_cache_header *m_header = nullptr;
+
+public:
+    using name_resolver = std::function<std::string(const file_meta &)>;
+
+    explicit index_cache(const std::string &path);
+
+    [[nodiscard]] static std::string path_for(const std::string &cache_dir, const index_cache_key &key);
+    // Writes a cache atomically; returns false if it could not be written.
+    [[nodiscard]] static bool write(const std::string &path, const index_cache_key &key, const table &t, const name_resolver &resolve_name);
+
+    [[nodiscard]] bool matches(const index_cache_key &key) const;
+
+    [[nodiscard]] std::uint64_t table_checksum() const;
+    [[nodiscard]] span<const file_meta> entries() const;
+    [[nodiscard]] span<const offset> offsets() const;
+    [[nodiscard]] span<const std::uint64_t> dependency_hashes() const;
+    [[nodiscard]] span<const std::uint64_t> index_hashes() const;
+    [[nodiscard]] span<const std::uint32_t> index_positions() const;
+    [[nodiscard]] span<const std::uint32_t> index_buckets() const;
+    [[nodiscard]] std::uint32_t index_bucket_shift() const;
+    // Entry i is named by name_pool()[name_offsets()[i], name_offsets()[i + 1]).
+    [[nodiscard]] span<const std::uint32_t> name_offsets() const;
+    [[nodiscard]] byte_span name_pool() const;
+
+private:
+    template <typename T>
+    [[nodiscard]] span<const T> section(std::uint64_t offset, std::uint64_t count) const;
+};
+
+}// namespace rdar
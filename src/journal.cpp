@@ -0,0 +1,152 @@
+#include "journal.h"
+#include "mapped_file.h"
+#include "util.h"
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fmt/core.h>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace rdar {
+
+constexpr auto g_journal_magic = std::array<char, 8>{'R', 'D', 'A', 'R', 'J', 'R', 'N', 'L'};
+constexpr std::uint32_t g_journal_version = 1;
+constexpr std::size_t g_journal_batch = 1024;
+
+struct journal_header {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t record_size;
+    std::uint64_t key;
+};
+
+static std::uint64_t record_check(std::uint64_t hash, std::uint64_t size, std::uint64_t key) {
+    std::array<char, 16> bytes{};
+    std::memcpy(bytes.data(), &hash, sizeof(hash));
+    std::memcpy(bytes.data() + sizeof(hash), &size, sizeof(size));
+    return fnv1a64(std::string_view(bytes.data(), bytes.size())) ^ key;
+}
+
+std::string journal::path_for(const std::string &output_dir, std::uint64_t key) {
+    return fmt::format("{}/.rdar-journal-{:016x}", output_dir, key);
+}
+
+journal::journal(std::string path, std::uint64_t key) : m_path(std::move(path)), m_key(key) {
+    load();
+
+#ifdef _WIN32
+    m_fd = ::_open(m_path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    m_fd = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+    if (m_fd < 0) {
+        throw std::runtime_error("could not open journal");
+    }
+
+    // A fresh journal, or one that could not be used, starts over with its
+    // header; whatever follows the last intact record is cut off.
+    std::error_code ec;
+    auto size = std::filesystem::file_size(m_path, ec);
+    if (m_valid_size == 0) {
+        std::filesystem::resize_file(m_path, 0, ec);
+        journal_header hdr{};
+        hdr.magic = g_journal_magic;
+        hdr.version = g_journal_version;
+        hdr.record_size = sizeof(journal_record);
+        hdr.key = m_key;
+        if (!write_all(m_fd, byte_span(reinterpret_cast<const char *>(&hdr), sizeof(hdr)))) {
+            throw std::runtime_error("could not write journal");
+        }
+    } else if (!ec && size != m_valid_size) {
+        std::filesystem::resize_file(m_path, m_valid_size, ec);
+    }
+}
+
+journal::~journal() {
+    if (m_fd >= 0) {
+#ifdef _WIN32
+        ::_close(m_fd);
+#else
+        ::close(m_fd);
+#endif
+    }
+}
+
+void journal::load() {
+    mapped_file file(m_path);
+    auto data = file.data();
+    if (data.size() < sizeof(journal_header)) {
+        return;
+    }
+
+    journal_header hdr;
+    std::memcpy(&hdr, data.data(), sizeof(hdr));
+    if (hdr.magic != g_journal_magic || hdr.version != g_journal_version || hdr.record_size != sizeof(journal_record) || hdr.key != m_key) {
+        return;
+    }
+
+    // Records are read up to the first one torn by an interruption.
+    auto at = sizeof(journal_header);
+    for (; at + sizeof(journal_record) <= data.size(); at += sizeof(journal_record)) {
+        journal_record record;
+        std::memcpy(&record, data.data() + at, sizeof(record));
+        if (record.check != record_check(record.hash, record.size, m_key)) {
+            break;
+        }
+        m_finished.insert(record.hash);
+    }
+    m_valid_size = at;
+}
+
+bool journal::finished(std::uint64_t hash) const {
+    return m_finished.count(hash) != 0;
+}
+
+void journal::record(std::uint64_t hash, std::uint64_t size) {
+    std::vector<journal_record> batch;
+    {
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        m_pending.push_back(journal_record{hash, size, record_check(hash, size, m_key)});
+        if (m_pending.size() < g_journal_batch) {
+            return;
+        }
+        batch.swap(m_pending);
+    }
+    write(std::move(batch));
+}
+
+void journal::commit() {
+    std::vector<journal_record> batch;
+    {
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        batch.swap(m_pending);
+    }
+    write(std::move(batch));
+}
+
+void journal::write(std::vector<journal_record> records) {
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    if (!records.empty() && !write_all(m_fd, byte_span(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(journal_record)))) {
+        throw std::runtime_error("could not write journal");
+    }
+#ifdef _WIN32
+    ::_commit(m_fd);
+#else
+    ::fsync(m_fd);
+#endif
+}
+
+void journal::remove() {
+    std::error_code ec;
+    std::filesystem::remove(m_path, ec);
+}
+
+}// namespace rdar
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace rdar {
+
+struct journal_record {
+    std::uint64_t hash;
+    std::uint64_t size;
+    std::uint64_t check;
+};
+
+// Append-only log of the entries an extraction has finished, so an
+// interrupted run can be resumed. A record is only appended once its output
+// file was synced to disk (see disk_sink's durable mode), and records are
+// fsynced in batches, so after a crash or power loss every intact record
+// names a file whose data is on disk; at worst the last batch is lost and
+// its entries are extracted again. The directory entries of new files are
+// left to the file system's own metadata ordering.
+class journal {
+    std::string m_path;
+    std::uint64_t m_key;
+    int m_fd = -1;
+    // Hashes of the entries earlier runs finished.
+    std::unordered_set<std::uint64_t> m_finished;
+    // Bytes of the header and the records read back intact, or 0 if the
+    // journal has to start over.
+    std::uint64_t m_valid_size = 0;
+    std::vector<journal_record> m_pending;
+    std::mutex m_pending_mutex;
+    std::mutex m_write_mutex;
+
+public:
+    // The journal of a run writing into output_dir, told apart from others
+    // by key.
+    [[nodiscard]] static std::string path_for(const std::string &output_dir, std::uint64_t key);
+
+    // Opens the journal of an earlier run with the same key, or starts a new
+    // one.
+    journal(std::string path, std::uint64_t key);
+    ~journal();
+
+    journal(const journal &) = delete;
+    journal &operator=(const journal &) = delete;
+
+    // Whether an earlier run finished the entry.
+    [[nodiscard]] bool finished(std::uint64_t hash) const;
+    // Records a finished entry, whose output must already be on disk; every
+    // full batch is written and fsynced.
+    void record(std::uint64_t hash, std::uint64_t size);
+    // Writes and fsyncs every pending record.
+    void commit();
+    // Deletes the journal once the run is complete.
+    void remove();
+
+private:
+    void load();
+    void write(std::vector<journal_record> records);
+};
+
+}// namespace rdar
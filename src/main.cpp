@@ -1,12 +1,32 @@
 #include "archive.h"
+#include "catalog.h"
+#include "dictionary.h"
+#include "discovery.h"
+#include "disk_sink.h"
+#include "index_cache.h"
+#include "journal.h"
+#include "manifest.h"
+#include "mount.h"
+#include "tar_sink.h"
 #include "util.h"
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
 #include <cstring>
 #include <ctime>
+#include <filesystem>
 #include <fmt/core.h>
-#include <fstream>
+#include <memory>
+#include <optional>
+#include <thread>
 
 std::string human_readable_size(std::uint64_t size);
+void print_files(const std::vector<rdar::file_parsed_info> &files);
+rdar::extract_options parse_extract_options(int argc, char **argv, int first);
+bool has_flag(int argc, char **argv, int first, const char *flag);
+int run_mounted(int argc, char **argv, const std::string &hashes_file, const std::string &codebooks_file, const rdar::codec_registry &codecs, std::size_t threads);
+int run_catalogued(int argc, char **argv, const std::string &codebooks_file, const rdar::codec_registry &codecs, std::size_t threads);
+std::uint64_t parse_hash_or_path(const char *arg);
 
 int main(int argc, char **argv) {
     if (argc < 3) {
@@ -26,28 +46,93 @@ int main(int argc, char **argv) {
         codebooks_file = codebooks_file_env;
     }
 
-    std::ifstream hashes_file_stream(hashes_file);
-    if (!hashes_file_stream.is_open()) {
-        fmt::print(stderr, "could not open hashes file");
-        return 1;
+    const char *kraken_library_env = std::getenv("KRAKEN_LIBRARY");
+    std::string kraken_library = rdar::kraken_codec::default_library;
+    if (kraken_library_env != nullptr) {
+        kraken_library = kraken_library_env;
+    }
+    auto codecs = rdar::codec_registry::with_defaults(kraken_library);
+
+    auto threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    // Compiles a hashes.csv list into a dictionary, which HASHES_FILE may
+    // then name instead of the list.
+    if (std::strcmp(argv[1], "compile-dictionary") == 0) {
+        if (argc < 4) {
+            fmt::print(stderr, "not enough arguments");
+            return 1;
+        }
+        rdar::mapped_file list(argv[2]);
+        if (!list.is_open()) {
+            fmt::print(stderr, "could not open hashes file");
+            return 1;
+        }
+        if (!rdar::dictionary::write(argv[3], rdar::read_hashes(list.data(), threads))) {
+            fmt::print(stderr, "could not write dictionary");
+            return 1;
+        }
+        return 0;
+    }
+
+    // A directory stands for every archive below it, mounted together.
+    std::error_code ec;
+    if (std::filesystem::is_directory(argv[2], ec)) {
+        return run_mounted(argc, argv, hashes_file, codebooks_file, codecs, threads);
     }
-    auto hashes = rdar::read_hashes(hashes_file_stream);
 
-    std::ifstream stream(argv[2]);
-    if (!stream.is_open()) {
+    rdar::mapped_file archive_file(argv[2]);
+    if (!archive_file.is_open()) {
         fmt::print(stderr, "could not open file");
         return 1;
     }
 
-    rdar::archive archive(stream, hashes, codebooks_file);
+    // With RDAR_CACHE_DIR set the parsed table and resolved names are kept in
+    // an index cache, so later runs neither parse the table nor read hashes.
+    const char *cache_dir = std::getenv("RDAR_CACHE_DIR");
+    std::optional<rdar::index_cache> cache;
+    rdar::index_cache_key cache_key;
+    if (cache_dir != nullptr) {
+        cache_key = rdar::make_index_cache_key(argv[2], archive_file, hashes_file);
+        cache.emplace(rdar::index_cache::path_for(cache_dir, cache_key));
+    }
 
-    if (std::strcmp(argv[1], "list") == 0) {
-        auto files = archive.list_files();
-        for (auto &f : files) {
-            std::time_t unix_time = f.time;
-            auto local = *std::localtime(&unix_time);
-            fmt::print("{}-{}-{} {}:{}  {: <10} {:<32} {}\n", local.tm_year + 1900, local.tm_mon, local.tm_mday, local.tm_hour, local.tm_min, human_readable_size(f.size), f.hash, f.name);
+    std::optional<rdar::dictionary> names;
+    std::optional<rdar::archive> archive;
+    if (cache && cache->matches(cache_key)) {
+        archive.emplace(archive_file, *cache, codebooks_file, codecs);
+    } else {
+        archive.emplace(archive_file, codebooks_file, codecs);
+
+        // Commands that neither print nor write names go without them. Of a
+        // hashes.csv list only the names in the archive are kept.
+        if (std::strcmp(argv[1], "single") != 0) {
+            names.emplace(hashes_file, threads, archive->file_table().index());
+            if (!names->is_open()) {
+                fmt::print(stderr, "could not open hashes file");
+                return 1;
+            }
+            archive->attach(*names);
         }
+
+        if (cache_dir != nullptr && names && !archive->save_index(rdar::index_cache::path_for(cache_dir, cache_key), cache_key)) {
+            fmt::print(stderr, "could not write index cache\n");
+        }
+    }
+
+    // Decoded segments are kept within RDAR_SEGMENT_CACHE_MB (0 disables it),
+    // so segments shared between entries and WEM probes are decoded once.
+    const char *segment_cache_env = std::getenv("RDAR_SEGMENT_CACHE_MB");
+    std::size_t segment_cache_mb = 64;
+    if (segment_cache_env != nullptr) {
+        segment_cache_mb = std::strtoull(segment_cache_env, nullptr, 10);
+    }
+    rdar::segment_cache segments(segment_cache_mb * 1024 * 1024);
+    if (segment_cache_mb != 0) {
+        archive->attach(segments);
+    }
+
+    if (std::strcmp(argv[1], "list") == 0) {
+        print_files(archive->list_files());
     } else if (std::strcmp(argv[1], "single") == 0) {
         if (argc < 4) {
             fmt::print(stderr, "not enough arguments");
@@ -55,28 +140,314 @@ int main(int argc, char **argv) {
         }
 
         auto hash = std::strtoull(argv[3], nullptr, 10);
-        archive.extract_file(std::cout, hash);
-    } else if (std::strcmp(argv[1], "extract") == 0) {
+        archive->extract_file(fileno(stdout), hash, threads);
+    } else if (std::strcmp(argv[1], "discover") == 0) {
         if (argc < 4) {
             fmt::print(stderr, "not enough arguments");
             return 1;
         }
 
-        rdar::file_sink sink(argv[3]);
-        archive.extract_all(sink);
-    } else if (std::strcmp(argv[1], "extract-wem") == 0) {
+        // Candidate paths come from a pattern, whose "{}" take the words of
+        // the word lists that follow it; matches are printed as hashes.csv
+        // lines.
+        std::size_t discover_threads = threads;
+        std::vector<std::vector<std::string>> word_lists;
+        for (int i = 4; i < argc; ++i) {
+            if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+                discover_threads = std::max<std::size_t>(std::strtoull(argv[++i], nullptr, 10), 1);
+            } else {
+                word_lists.push_back(rdar::read_word_list(argv[i]));
+            }
+        }
+        rdar::path_template pattern(argv[3], std::move(word_lists));
+
+        rdar::file_index unnamed;
+        unnamed.build(archive->unnamed_hashes());
+        rdar::hash_filter targets(unnamed);
+        auto found = rdar::discover(pattern, targets, discover_threads);
+        for (auto &match : found) {
+            fmt::print("{},{}\n", match.path, match.hash);
+        }
+        fmt::print(stderr, "{} candidates, {} of {} unnamed entries found\n", pattern.size(), found.size(), unnamed.size());
+    } else if (std::strcmp(argv[1], "extract") == 0 || std::strcmp(argv[1], "extract-wem") == 0) {
         if (argc < 4) {
             fmt::print(stderr, "not enough arguments");
             return 1;
         }
 
-        rdar::file_sink sink(argv[3]);
-        archive.extract_all_convert_wem(sink);
+        // Files go below an output directory, with --tar <file> into a single
+        // tar stream, where - is stdout, or with --bundle <file> into a bundle.
+        bool tar = std::strcmp(argv[3], "--tar") == 0;
+        bool bundle = std::strcmp(argv[3], "--bundle") == 0;
+        if ((tar || bundle) && argc < 5) {
+            fmt::print(stderr, "not enough arguments");
+            return 1;
+        }
+
+        auto options = parse_extract_options(argc, argv, tar || bundle ? 5 : 4);
+        if (bundle) {
+            if (std::strcmp(argv[1], "extract") != 0) {
+                fmt::print(stderr, "bundles only hold extracted files");
+                return 1;
+            }
+            archive->extract_bundle(argv[4], options);
+            return 0;
+        }
+
+        bool incremental = has_flag(argc, argv, 4, "--incremental");
+        bool resume = has_flag(argc, argv, 4, "--resume");
+        if (incremental && resume) {
+            fmt::print(stderr, "--incremental and --resume cannot be combined");
+            return 1;
+        }
+        if (resume && options.dedup) {
+            fmt::print(stderr, "--resume cannot be combined with --dedup");
+            return 1;
+        }
+
+        // With --incremental only entries changed since the last extraction
+        // into the directory, or missing from it, are written.
+        if (incremental) {
+            if (tar || std::strcmp(argv[1], "extract") != 0) {
+                fmt::print(stderr, "only extraction into a directory is incremental");
+                return 1;
+            }
+            rdar::disk_sink sink(argv[3], options.async_io, options.verbose);
+            auto manifest_path = rdar::manifest::path_for(argv[3]);
+            auto manifest = rdar::manifest::load(manifest_path);
+            archive->extract_changed(sink, manifest, options);
+            if (!manifest.save(manifest_path)) {
+                fmt::print(stderr, "could not write manifest\n");
+                return 1;
+            }
+            return 0;
+        }
+
+        // With --resume finished entries are journaled, so an interrupted run
+        // started again with it only extracts what is left.
+        if (resume) {
+            if (tar) {
+                fmt::print(stderr, "only extraction into a directory is resumable");
+                return 1;
+            }
+            bool convert_wem = std::strcmp(argv[1], "extract-wem") == 0;
+            rdar::disk_sink sink(argv[3], options.async_io, options.verbose, true);
+            auto journal_key = archive->file_table().checksum() ^ rdar::fnv1a64(argv[1]);
+            rdar::journal journal(rdar::journal::path_for(argv[3], journal_key), journal_key);
+            archive->extract_resumable(sink, journal, convert_wem, options);
+            journal.remove();
+            return 0;
+        }
+
+        std::unique_ptr<rdar::file_sink> sink;
+        if (tar) {
+            sink = std::make_unique<rdar::tar_sink>(argv[4]);
+        } else {
+            sink = std::make_unique<rdar::disk_sink>(argv[3], options.async_io, options.verbose);
+        }
+
+        if (std::strcmp(argv[1], "extract") == 0) {
+            archive->extract_all(*sink, options);
+        } else {
+            archive->extract_all_convert_wem(*sink, options);
+        }
     }
 
     return 0;
 }
 
+int run_mounted(int argc, char **argv, const std::string &hashes_file, const std::string &codebooks_file, const rdar::codec_registry &codecs, std::size_t threads) {
+    if (std::strcmp(argv[1], "single") == 0 || std::strcmp(argv[1], "locate") == 0) {
+        return run_catalogued(argc, argv, codebooks_file, codecs, threads);
+    }
+
+    rdar::mount mount(argv[2], codebooks_file, codecs, threads);
+    rdar::dictionary names(hashes_file, threads, mount.index());
+    if (!names.is_open()) {
+        fmt::print(stderr, "could not open hashes file");
+        return 1;
+    }
+    mount.attach(names);
+
+    if (std::strcmp(argv[1], "list") == 0) {
+        print_files(mount.list_files());
+    } else if (std::strcmp(argv[1], "extract") == 0 || std::strcmp(argv[1], "extract-wem") == 0) {
+        if (argc < 4) {
+            fmt::print(stderr, "not enough arguments");
+            return 1;
+        }
+
+        // Bundles, manifests and journals belong to a single archive; an
+        // option in place of the output directory is not taken as one.
+        bool tar = std::strcmp(argv[3], "--tar") == 0;
+        if (std::strcmp(argv[3], "--bundle") == 0) {
+            fmt::print(stderr, "only a single archive can be extracted into a bundle");
+            return 1;
+        }
+        if (has_flag(argc, argv, 3, "--incremental") || has_flag(argc, argv, 3, "--resume")) {
+            fmt::print(stderr, "only extraction from a single archive is incremental or resumable");
+            return 1;
+        }
+        if (!tar && std::strncmp(argv[3], "--", 2) == 0) {
+            fmt::print(stderr, "not enough arguments");
+            return 1;
+        }
+        if (tar && argc < 5) {
+            fmt::print(stderr, "not enough arguments");
+            return 1;
+        }
+        auto options = parse_extract_options(argc, argv, tar ? 5 : 4);
+        std::unique_ptr<rdar::file_sink> sink;
+        if (tar) {
+            sink = std::make_unique<rdar::tar_sink>(argv[4]);
+        } else {
+            sink = std::make_unique<rdar::disk_sink>(argv[3], options.async_io, options.verbose);
+        }
+
+        if (std::strcmp(argv[1], "extract") == 0) {
+            mount.extract_all(*sink, options);
+        } else {
+            mount.extract_all_convert_wem(*sink, options);
+        }
+    } else {
+        fmt::print(stderr, "command not supported for a directory of archives");
+        return 1;
+    }
+    return 0;
+}
+
+// With RDAR_CACHE_DIR set, lookups go through a catalog of the directory
+// kept there, which tells the archive holding a hash without opening any.
+// It is rebuilt once the archives change. Without it the archives are
+// mounted.
+int run_catalogued(int argc, char **argv, const std::string &codebooks_file, const rdar::codec_registry &codecs, std::size_t threads) {
+    if (argc < 4) {
+        fmt::print(stderr, "not enough arguments");
+        return 1;
+    }
+
+    const char *cache_dir = std::getenv("RDAR_CACHE_DIR");
+    std::optional<rdar::catalog> catalog;
+    std::optional<rdar::mount> mount;
+    if (cache_dir != nullptr) {
+        auto fingerprint = rdar::fingerprint_archives(argv[2]);
+        auto catalog_path = rdar::catalog::path_for(cache_dir, argv[2]);
+        catalog.emplace(catalog_path);
+        if (!catalog->matches(fingerprint)) {
+            catalog.reset();
+            mount.emplace(argv[2], codebooks_file, codecs, threads);
+            if (!rdar::catalog::write(catalog_path, *mount, fingerprint)) {
+                fmt::print(stderr, "could not write catalog\n");
+            }
+        }
+    } else {
+        mount.emplace(argv[2], codebooks_file, codecs, threads);
+    }
+
+    if (std::strcmp(argv[1], "locate") == 0) {
+        // Every archive holding each file, one line each; the last one
+        // provides the file.
+        int result = 0;
+        for (int i = 3; i < argc; ++i) {
+            auto hash = parse_hash_or_path(argv[i]);
+            auto holders = catalog ? catalog->find_all(hash) : mount->find_all(hash);
+            if (holders.empty()) {
+                fmt::print(stderr, "{} not found in archives\n", argv[i]);
+                result = 1;
+            }
+            for (auto &holder : holders) {
+                auto archive_path = catalog ? std::string(catalog->path_at(holder.archive)) : mount->path_at(holder.archive);
+                fmt::print("{} {} {}\n", hash, archive_path, holder.entry);
+            }
+        }
+        return result;
+    }
+
+    auto hash = parse_hash_or_path(argv[3]);
+    if (mount) {
+        mount->extract_file(fileno(stdout), hash, threads);
+        return 0;
+    }
+
+    // Only the archive providing the file is opened, and only its entry read.
+    auto entry = catalog->find(hash);
+    if (!entry) {
+        fmt::print(stderr, "file not found in archives");
+        return 1;
+    }
+    rdar::mapped_file file(std::string(argv[2]) + '/' + std::string(catalog->path_at(entry->archive)));
+    if (!file.is_open()) {
+        fmt::print(stderr, "could not open file");
+        return 1;
+    }
+    rdar::archive archive(file, codebooks_file, codecs);
+    auto meta = archive.file_table().entry_at(entry->entry);
+    if (meta.m_hash != hash) {
+        fmt::print(stderr, "catalog out of date");
+        return 1;
+    }
+    archive.extract_file(fileno(stdout), meta, threads);
+    return 0;
+}
+
+// Files are named by hash or by path, with either kind of slash.
+std::uint64_t parse_hash_or_path(const char *arg) {
+    if (std::all_of(arg, arg + std::strlen(arg), [](char c) { return c >= '0' && c <= '9'; })) {
+        return std::strtoull(arg, nullptr, 10);
+    }
+    std::string path(arg);
+    std::replace(path.begin(), path.end(), '/', '\\');
+    return rdar::fnv1a64(path);
+}
+
+void print_files(const std::vector<rdar::file_parsed_info> &files) {
+    for (auto &f : files) {
+        std::time_t unix_time = f.time;
+        auto local = *std::localtime(&unix_time);
+        fmt::print("{}-{}-{} {}:{}  {: <10} {:<32} {}\n", local.tm_year + 1900, local.tm_mon, local.tm_mday, local.tm_hour, local.tm_min, human_readable_size(f.size), f.hash, f.name);
+    }
+}
+
+rdar::extract_options parse_extract_options(int argc, char **argv, int first) {
+    rdar::extract_options options;
+    for (int i = first; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.threads = std::strtoull(argv[++i], nullptr, 10);
+            if (options.threads == 0) {
+                options.threads = std::max(std::thread::hardware_concurrency(), 1u);
+            }
+        } else if (std::strcmp(argv[i], "--steal") == 0) {
+            options.in_order = false;
+        } else if (std::strcmp(argv[i], "--coalesce-gap") == 0 && i + 1 < argc) {
+            options.coalesce_gap = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--coalesce-max") == 0 && i + 1 < argc) {
+            options.coalesce_max = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--sync-io") == 0) {
+            options.async_io = false;
+        } else if (std::strcmp(argv[i], "--decode-threads") == 0 && i + 1 < argc) {
+            options.decode_threads = std::max<std::size_t>(std::strtoull(argv[++i], nullptr, 10), 1);
+        } else if (std::strcmp(argv[i], "--verbose") == 0) {
+            options.verbose = true;
+        } else if (std::strcmp(argv[i], "--no-kernel-copy") == 0) {
+            options.kernel_copy = false;
+        } else if (std::strcmp(argv[i], "--dedup") == 0) {
+            options.dedup = rdar::link_kind::reflink;
+        } else if (std::strcmp(argv[i], "--dedup-hardlinks") == 0) {
+            options.dedup = rdar::link_kind::hard;
+        }
+    }
+    return options;
+}
+
+bool has_flag(int argc, char **argv, int first, const char *flag) {
+    for (int i = first; i < argc; ++i) {
+        if (std::strcmp(argv[i], flag) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 std::string human_readable_size(std::uint64_t size) {
     if (size < 1024) {
         return std::to_string(size) + "B";
@@ -0,0 +1,107 @@
+#include "manifest.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fmt/core.h>
+#include <fstream>
+#include <type_traits>
+#include <vector>
+
+namespace rdar {
+
+constexpr auto g_manifest_magic = std::array<char, 8>{'R', 'D', 'A', 'R', 'M', 'N', 'F', '\0'};
+constexpr std::uint32_t g_manifest_version = 1;
+
+static_assert(std::is_trivially_copyable_v<manifest_entry>, "manifest entries are stored verbatim");
+
+struct manifest_header {
+    std::array<char, 8> magic;
+    std::uint32_t version;
+    std::uint32_t entry_size;
+    std::uint64_t num_entries;
+};
+
+std::string manifest::path_for(const std::string &output_dir) {
+    return output_dir + "/.rdar-manifest";
+}
+
+manifest manifest::load(const std::string &path) {
+    manifest result;
+    mapped_file file(path);
+    auto data = file.data();
+    if (data.size() < sizeof(manifest_header)) {
+        return result;
+    }
+
+    manifest_header hdr;
+    std::memcpy(&hdr, data.data(), sizeof(hdr));
+    if (hdr.magic != g_manifest_magic || hdr.version != g_manifest_version || hdr.entry_size != sizeof(manifest_entry) ||
+        hdr.num_entries != (data.size() - sizeof(manifest_header)) / sizeof(manifest_entry)) {
+        return result;
+    }
+
+    result.m_entries.reserve(hdr.num_entries);
+    for (std::uint64_t i = 0; i < hdr.num_entries; ++i) {
+        manifest_entry entry;
+        std::memcpy(&entry, data.data() + sizeof(manifest_header) + i * sizeof(manifest_entry), sizeof(entry));
+        result.m_entries.emplace(entry.hash, entry);
+    }
+    return result;
+}
+
+bool manifest::is_current(const file_meta &meta, std::uint64_t size) const {
+    auto at = m_entries.find(meta.m_hash);
+    if (at == m_entries.end()) {
+        return false;
+    }
+    auto &entry = at->second;
+    return entry.sha1 == meta.m_sha1 && entry.size == size && entry.time == meta.m_time;
+}
+
+void manifest::record(const file_meta &meta, std::uint64_t size) {
+    m_entries[meta.m_hash] = manifest_entry{.hash = meta.m_hash, .size = size, .time = meta.m_time, .sha1 = meta.m_sha1, .reserved = 0};
+}
+
+std::size_t manifest::size() const {
+    return m_entries.size();
+}
+
+bool manifest::save(const std::string &path) const {
+    std::vector<manifest_entry> entries;
+    entries.reserve(m_entries.size());
+    for (auto &[hash, entry] : m_entries) {
+        entries.push_back(entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](const manifest_entry &a, const manifest_entry &b) {
+        return a.hash < b.hash;
+    });
+
+    manifest_header hdr{};
+    hdr.magic = g_manifest_magic;
+    hdr.version = g_manifest_version;
+    hdr.entry_size = sizeof(manifest_entry);
+    hdr.num_entries = entries.size();
+
+    std::error_code ec;
+    auto tmp_path = fmt::format("{}.{}.tmp", path, std::chrono::steady_clock::now().time_since_epoch().count());
+    {
+        std::ofstream out(tmp_path, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+        out.write(reinterpret_cast<const char *>(entries.data()), static_cast<std::streamsize>(entries.size() * sizeof(manifest_entry)));
+        if (!out) {
+            out.close();
+            std::filesystem::remove(tmp_path, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+}// namespace rdar
@@ -0,0 +1,40 @@
+#pragma once
+#include "archive.h"
+#include "disk_sink.h"
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace rdar {
+
+// What an extracted file was produced from.
+struct manifest_entry {
+    std::uint64_t hash;
+    std::uint64_t size;
+    std::uint64_t time;
+    std::array<std::uint8_t, 20> sha1;
+    std::uint32_t reserved;
+};
+
+// Records, per entry hash, the content an output directory was last
+// extracted from, so unchanged entries can be skipped. Entries of every
+// archive extracted into the directory are kept side by side.
+class manifest {
+    std::unordered_map<std::uint64_t, manifest_entry> m_entries;
+
+public:
+    // The manifest of an output directory.
+    [[nodiscard]] static std::string path_for(const std::string &output_dir);
+    // Returns an empty manifest if the file is missing or invalid.
+    [[nodiscard]] static manifest load(const std::string &path);
+
+    // Whether the entry was extracted from the same content as before.
+    [[nodiscard]] bool is_current(const file_meta &meta, std::uint64_t size) const;
+    void record(const file_meta &meta, std::uint64_t size);
+    [[nodiscard]] std::size_t size() const;
+    // Writes the manifest atomically; returns false if it could not be written.
+    [[nodiscard]] bool save(const std::string &path) const;
+};
+
+}// namespace rdar
@@ -0,0 +1,257 @@
+#include "mapped_file.h"
+#include "util.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+namespace rdar {
+
+#ifdef _WIN32
+
+mapped_file::mapped_file(const std::string &path) {
+    m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        m_file = nullptr;
+        return;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size)) {
+        close();
+        return;
+    }
+    m_size = static_cast<std::size_t>(size.QuadPart);
+    if (m_size == 0) {
+        return;
+    }
+
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping == nullptr) {
+        close();
+        return;
+    }
+
+    m_data = static_cast<const char *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_data == nullptr) {
+        close();
+    }
+}
+
+bool mapped_file::is_open() const {
+    return m_file != nullptr;
+}
+
+void mapped_file::will_need(std::uint64_t, std::size_t) const {
+}
+
+std::size_t mapped_file::copy_to(int, std::uint64_t, std::size_t) const {
+    return 0;
+}
+
+std::size_t mapped_file::copy_to(int, std::uint64_t, std::size_t, std::uint64_t) const {
+    return 0;
+}
+
+void mapped_file::close() {
+    if (m_data != nullptr) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping != nullptr) {
+        CloseHandle(m_mapping);
+    }
+    if (m_file != nullptr) {
+        CloseHandle(m_file);
+    }
+    m_data = nullptr;
+    m_mapping = nullptr;
+    m_file = nullptr;
+    m_size = 0;
+}
+
+#else
+
+mapped_file::mapped_file(const std::string &path) {
+    m_fd = ::open(path.c_str(), O_RDONLY);
+    if (m_fd < 0) {
+        return;
+    }
+
+    struct stat st {};
+    if (::fstat(m_fd, &st) != 0) {
+        close();
+        return;
+    }
+    m_size = static_cast<std::size_t>(st.st_size);
+    if (m_size == 0) {
+        return;
+    }
+
+    auto *data = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED) {
+        close();
+        return;
+    }
+    m_data = static_cast<const char *>(data);
+}
+
+bool mapped_file::is_open() const {
+    return m_fd >= 0;
+}
+
+void mapped_file::will_need(std::uint64_t offset, std::size_t size) const {
+    if (m_data == nullptr || offset >= m_size) {
+        return;
+    }
+    static const auto page_size = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+    auto begin = offset - offset % page_size;
+    auto end = std::min<std::uint64_t>(offset + size, m_size);
+    ::madvise(const_cast<char *>(m_data) + begin, end - begin, MADV_WILLNEED);
+}
+
+#ifdef __linux__
+
+namespace {
+
+using kernel_copy = ssize_t (*)(int in, off_t *offset, int out, std::size_t size);
+
+ssize_t copy_range(int in, off_t *offset, int out, std::size_t size) {
+    return ::copy_file_range(in, offset, out, nullptr, size, 0);
+}
+
+ssize_t splice_range(int in, off_t *offset, int out, std::size_t size) {
+    return ::splice(in, offset, out, nullptr, size, SPLICE_F_MOVE);
+}
+
+ssize_t send_range(int in, off_t *offset, int out, std::size_t size) {
+    return ::sendfile(out, in, offset, size);
+}
+
+}// namespace
+
+std::size_t mapped_file::copy_to(int fd, std::uint64_t offset, std::size_t size) const {
+    if (m_fd < 0 || offset >= m_size) {
+        return 0;
+    }
+    size = static_cast<std::size_t>(std::min<std::uint64_t>(size, m_size - offset));
+
+    // Regular files are copied by the file system, which may share the
+    // extents; pipes take references to the page cache pages.
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        return 0;
+    }
+    kernel_copy copies[2] = {send_range, nullptr};
+    if (S_ISREG(st.st_mode)) {
+        copies[0] = copy_range;
+        copies[1] = send_range;
+    } else if (S_ISFIFO(st.st_mode)) {
+        copies[0] = splice_range;
+        copies[1] = send_range;
+    }
+
+    auto position = static_cast<off_t>(offset);
+    std::size_t moved = 0;
+    for (auto copy : copies) {
+        while (copy != nullptr && moved < size) {
+            auto result = copy(m_fd, &position, fd, size - moved);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                break;
+            }
+            moved += static_cast<std::size_t>(result);
+        }
+    }
+    return moved;
+}
+
+std::size_t mapped_file::copy_to(int fd, std::uint64_t offset, std::size_t size, std::uint64_t position) const {
+    if (m_fd < 0 || offset >= m_size) {
+        return 0;
+    }
+    size = static_cast<std::size_t>(std::min<std::uint64_t>(size, m_size - offset));
+
+    auto in_position = static_cast<off_t>(offset);
+    auto out_position = static_cast<off_t>(position);
+    std::size_t moved = 0;
+    while (moved < size) {
+        auto result = ::copy_file_range(m_fd, &in_position, fd, &out_position, size - moved, 0);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        moved += static_cast<std::size_t>(result);
+    }
+    return moved;
+}
+
+#else
+
+std::size_t mapped_file::copy_to(int, std::uint64_t, std::size_t) const {
+    return 0;
+}
+
+std::size_t mapped_file::copy_to(int, std::uint64_t, std::size_t, std::uint64_t) const {
+    return 0;
+}
+
+#endif
+
+void mapped_file::close() {
+    if (m_data != nullptr) {
+        ::munmap(const_cast<char *>(m_data), m_size);
+    }
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+    m_data = nullptr;
+    m_fd = -1;
+    m_size = 0;
+}
+
+#endif
+
+bool mapped_file::write_to(int fd, std::uint64_t offset, std::size_t size) const {
+    if (offset > m_size || size > m_size - offset) {
+        return false;
+    }
+    auto moved = copy_to(fd, offset, size);
+    return write_all(fd, data().subspan(offset + moved, size - moved));
+}
+
+bool mapped_file::write_to(int fd, std::uint64_t offset, std::size_t size, std::uint64_t position) const {
+    if (offset > m_size || size > m_size - offset) {
+        return false;
+    }
+    auto moved = copy_to(fd, offset, size, position);
+    return write_all_at(fd, data().subspan(offset + moved, size - moved), position + moved);
+}
+
+mapped_file::~mapped_file() {
+    close();
+}
+
+byte_span mapped_file::data() const {
+    return byte_span(m_data, m_size);
+}
+
+std::size_t mapped_file::size() const {
+    return m_size;
+}
+
+}// namespace rdar
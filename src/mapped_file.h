@@ -0,0 +1,45 @@
+#pragma once
+#include "span.h"
+#include <string>
+
+namespace rdar {
+
+// Read-only memory mapping of a whole file.
+class mapped_file {
+    const char *m_data = nullptr;
+    std::size_t m_size = 0;
+#ifdef _WIN32
+    void *m_file = nullptr;
+    void *m_mapping = nullptr;
+#else
+    int m_fd = -1;
+#endif
+
+public:
+    explicit mapped_file(const std::string &path);
+    ~mapped_file();
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    [[nodiscard]] bool is_open() const;
+    [[nodiscard]] byte_span data() const;
+    [[nodiscard]] std::size_t size() const;
+
+    // Hints the kernel to read the whole range ahead in one go.
+    void will_need(std::uint64_t offset, std::size_t size) const;
+    // Writes a range of the file to the descriptor. Where the kernel can move
+    // the bytes itself they never pass through user space; anything it could
+    // not move is written from the mapping. Returns false on a write error.
+    [[nodiscard]] bool write_to(int fd, std::uint64_t offset, std::size_t size) const;
+    // Like write_to, but writes at a position of the output file and leaves
+    // its file position alone.
+    [[nodiscard]] bool write_to(int fd, std::uint64_t offset, std::size_t size, std::uint64_t position) const;
+
+private:
+    [[nodiscard]] std::size_t copy_to(int fd, std::uint64_t offset, std::size_t size) const;
+    [[nodiscard]] std::size_t copy_to(int fd, std::uint64_t offset, std::size_t size, std::uint64_t position) const;
+    void close();
+};
+
+}// namespace rdar
@@ -0,0 +1,45 @@
+#include "memory_sink.h"
+#include <utility>
+
+namespace rdar {
+
+bool memory_sink::write_file(std::string path, span<const byte_span> parts) {
+    std::size_t size = 0;
+    for (auto &part : parts) {
+        size += part.size();
+    }
+    std::string content;
+    content.reserve(size);
+    for (auto &part : parts) {
+        content.append(part.data(), part.size());
+    }
+    return write_file(std::move(path), std::move(content));
+}
+
+bool memory_sink::write_file(std::string path, std::string &&content) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_files[std::move(path)] = std::move(content);
+    return true;
+}
+
+bool memory_sink::link_file(std::string path, const std::string &target, link_kind) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto at = m_files.find(target);
+    if (at == m_files.end()) {
+        return false;
+    }
+    auto content = at->second;
+    m_files[std::move(path)] = std::move(content);
+    return true;
+}
+
+const std::map<std::string, std::string> &memory_sink::files() const {
+    return m_files;
+}
+
+std::map<std::string, std::string> memory_sink::take() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return std::exchange(m_files, {});
+}
+
+}// namespace rdar
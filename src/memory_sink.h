@@ -0,0 +1,27 @@
+#pragma once
+#include "file_sink.h"
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace rdar {
+
+// Keeps every extracted file in memory, by its path in the archive.
+class memory_sink : public file_sink {
+    std::map<std::string, std::string> m_files;
+    std::mutex m_mutex;
+
+public:
+    using file_sink::write_file;
+    bool write_file(std::string path, span<const byte_span> parts) override;
+    bool write_file(std::string path, std::string &&content) override;
+    // Copies the content, as files in memory cannot share it.
+    bool link_file(std::string path, const std::string &target, link_kind kind) override;
+
+    // Only to be read once extraction has returned.
+    [[nodiscard]] const std::map<std::string, std::string> &files() const;
+    // Hands the files over, leaving the sink empty.
+    [[nodiscard]] std::map<std::string, std::string> take();
+};
+
+}// namespace rdar
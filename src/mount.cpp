@@ -0,0 +1,165 @@
+#include "mount.h"
+#include "thread_pool.h"
+#include "util.h"
+#include <algorithm>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+
+namespace rdar {
+
+std::vector<std::string> list_archives(const std::string &directory) {
+    std::error_code ec;
+    std::vector<std::string> paths;
+    for (std::filesystem::recursive_directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_regular_file(ec) && it->path().extension() == ".archive") {
+            paths.push_back(it->path().lexically_relative(directory).generic_string());
+        }
+    }
+    if (ec) {
+        throw std::runtime_error("could not read archive directory");
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+std::uint64_t fingerprint_archives(const std::string &directory) {
+    auto hash = g_fnv_offset_basis;
+    for (auto &path : list_archives(directory)) {
+        auto archive_path = directory + '/' + path;
+        std::error_code ec;
+        auto size = std::filesystem::file_size(archive_path, ec);
+        if (ec) {
+            size = 0;
+        }
+        hash = fnv1a64(path + '\n' + std::to_string(size) + '\n' + std::to_string(file_mtime(archive_path)) + '\n', hash);
+    }
+    return hash;
+}
+
+mount::mount(const std::string &directory, const std::string &codebooks_file, const codec_registry &codecs, std::size_t threads) : m_directory(directory), m_paths(list_archives(directory)) {
+    m_files.resize(m_paths.size());
+    m_archives.resize(m_paths.size());
+    thread_pool(threads).run_in_order(m_paths.size(), [this, &codebooks_file, &codecs](std::size_t, std::size_t i) {
+        m_files[i] = std::make_unique<mapped_file>(m_directory + '/' + m_paths[i]);
+        if (!m_files[i]->is_open()) {
+            throw std::runtime_error("could not open archive " + m_paths[i]);
+        }
+        m_archives[i] = std::make_unique<archive>(*m_files[i], codebooks_file, codecs);
+        static_cast<void>(m_archives[i]->file_table().index());
+    });
+
+    // Later entries win in the index, so the last archive holding a hash
+    // provides it.
+    std::vector<std::uint64_t> hashes;
+    for (std::size_t i = 0; i < m_archives.size(); ++i) {
+        auto entries = m_archives[i]->file_table().file_entries();
+        for (std::size_t j = 0; j < entries.size(); ++j) {
+            hashes.push_back(entries[j].m_hash);
+            m_entries.push_back(mount_entry{static_cast<std::uint32_t>(i), static_cast<std::uint32_t>(j)});
+        }
+    }
+    if (hashes.size() >= std::numeric_limits<std::uint32_t>::max()) {
+        throw std::runtime_error("too many mounted entries");
+    }
+    m_index.build(hashes);
+}
+
+std::size_t mount::size() const {
+    return m_archives.size();
+}
+
+const std::string &mount::directory() const {
+    return m_directory;
+}
+
+const std::string &mount::path_at(std::size_t i) const {
+    return m_paths[i];
+}
+
+archive &mount::archive_at(std::size_t i) {
+    return *m_archives[i];
+}
+
+const file_index &mount::index() const {
+    return m_index;
+}
+
+const mount_entry *mount::find(std::uint64_t hash) const {
+    auto position = m_index.find(hash);
+    if (position == file_index::npos) {
+        return nullptr;
+    }
+    return &m_entries[position];
+}
+
+std::vector<mount_entry> mount::find_all(std::uint64_t hash) const {
+    std::vector<mount_entry> result;
+    for (std::size_t i = 0; i < m_archives.size(); ++i) {
+        auto position = m_archives[i]->file_table().index().find(hash);
+        if (position != file_index::npos) {
+            result.push_back(mount_entry{static_cast<std::uint32_t>(i), position});
+        }
+    }
+    return result;
+}
+
+const mount_entry *mount::find(std::string_view path) const {
+    std::string normalized(path);
+    std::replace(normalized.begin(), normalized.end(), '/', '\\');
+    return find(fnv1a64(normalized));
+}
+
+void mount::attach(const dictionary &names) {
+    for (auto &a : m_archives) {
+        a->attach(names);
+    }
+}
+
+bool mount::provides(std::size_t archive_index, const file_meta &meta) const {
+    auto provider = find(meta.m_hash);
+    return provider != nullptr && provider->archive == archive_index;
+}
+
+std::vector<file_parsed_info> mount::list_files() {
+    std::vector<file_parsed_info> result;
+    for (std::size_t i = 0; i < m_archives.size(); ++i) {
+        for (auto &info : m_archives[i]->list_files()) {
+            auto provider = find(info.hash);
+            if (provider != nullptr && provider->archive == i) {
+                result.push_back(std::move(info));
+            }
+        }
+    }
+    return result;
+}
+
+void mount::extract_file(int fd, std::uint64_t hash, std::size_t decode_threads) {
+    auto provider = find(hash);
+    if (provider == nullptr) {
+        throw std::out_of_range("file not found in archives");
+    }
+    m_archives[provider->archive]->extract_file(fd, hash, decode_threads);
+}
+
+extract_options mount::provided_by(std::size_t archive_index, const extract_options &options) const {
+    auto provided = options;
+    provided.filter = [this, archive_index, &options](const file_meta &meta) {
+        return (!options.filter || options.filter(meta)) && provides(archive_index, meta);
+    };
+    return provided;
+}
+
+void mount::extract_all(file_sink &sink, const extract_options &options) {
+    for (std::size_t i = 0; i < m_archives.size(); ++i) {
+        m_archives[i]->extract_all(sink, provided_by(i, options));
+    }
+}
+
+void mount::extract_all_convert_wem(file_sink &sink, const extract_options &options) {
+    for (std::size_t i = 0; i < m_archives.size(); ++i) {
+        m_archives[i]->extract_all_convert_wem(sink, provided_by(i, options));
+    }
+}
+
+}// namespace rdar
@@ -0,0 +1,75 @@
+#pragma once
+#include "archive.h"
+#include "codec.h"
+#include "dictionary.h"
+#include "file_index.h"
+#include "file_sink.h"
+#include "mapped_file.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rdar {
+
+// The archives below a directory, relative to it, in load order.
+[[nodiscard]] std::vector<std::string> list_archives(const std::string &directory);
+// A hash of the paths, sizes and modification times of the archives below a
+// directory, which changes whenever one is added, removed or rewritten.
+[[nodiscard]] std::uint64_t fingerprint_archives(const std::string &directory);
+
+// Where a mounted hash is found: an archive by load order and the position of
+// its entry in that archive's table.
+struct mount_entry {
+    std::uint32_t archive;
+    std::uint32_t entry;
+};
+
+// Every archive below a directory, seen as one. Archives load in the order of
+// their paths relative to the directory, and where several hold a hash the
+// last one wins, the way patch and mod archives override the base ones.
+class mount {
+    std::string m_directory;
+    std::vector<std::string> m_paths;
+    std::vector<std::unique_ptr<mapped_file>> m_files;
+    std::vector<std::unique_ptr<archive>> m_archives;
+    // Entries of all archives in load order, indexed by hash.
+    std::vector<mount_entry> m_entries;
+    file_index m_index;
+
+public:
+    // Opens and parses the archives on up to threads threads.
+    mount(const std::string &directory, const std::string &codebooks_file, const codec_registry &codecs, std::size_t threads);
+
+    [[nodiscard]] std::size_t size() const;
+    [[nodiscard]] const std::string &directory() const;
+    // The path of an archive relative to the directory.
+    [[nodiscard]] const std::string &path_at(std::size_t i) const;
+    [[nodiscard]] archive &archive_at(std::size_t i);
+    // The merged index; positions are into the entries in load order.
+    [[nodiscard]] const file_index &index() const;
+    // The archive and entry providing the hash, or nullptr.
+    [[nodiscard]] const mount_entry *find(std::uint64_t hash) const;
+    // Every archive holding the hash, in load order.
+    [[nodiscard]] std::vector<mount_entry> find_all(std::uint64_t hash) const;
+    // Looks a path up by its hash; forward slashes count as backslashes.
+    [[nodiscard]] const mount_entry *find(std::string_view path) const;
+
+    // Names the entries of every archive.
+    void attach(const dictionary &names);
+    // The files provided by each archive, in load order.
+    std::vector<file_parsed_info> list_files();
+    void extract_file(int fd, std::uint64_t hash, std::size_t decode_threads = 1);
+    // Extracts the files each archive provides, archive by archive.
+    void extract_all(file_sink &sink, const extract_options &options = {});
+    void extract_all_convert_wem(file_sink &sink, const extract_options &options = {});
+
+private:
+    [[nodiscard]] bool provides(std::size_t archive_index, const file_meta &meta) const;
+    // Options that only let through what the archive provides.
+    [[nodiscard]] extract_options provided_by(std::size_t archive_index, const extract_options &options) const;
+};
+
+}// namespace rdar
@@ -0,0 +1,27 @@
+#include "read_coalescer.h"
+#include <algorithm>
+
+namespace rdar {
+
+read_coalescer::read_coalescer(std::uint64_t max_gap, std::uint64_t max_size) : m_max_gap(max_gap), m_max_size(max_size) {
+}
+
+std::vector<coalesced_read> read_coalescer::coalesce(span<const byte_range> ranges) const {
+    std::vector<coalesced_read> result;
+    for (std::size_t i = 0; i < ranges.size(); ++i) {
+        auto &range = ranges[i];
+        if (!result.empty()) {
+            auto &current = result.back();
+            auto end = std::max(current.end, range.end);
+            if (range.begin <= current.end + m_max_gap && end - current.begin <= m_max_size) {
+                current.end = end;
+                current.last = i + 1;
+                continue;
+            }
+        }
+        result.push_back(coalesced_read{range.begin, range.end, i, i + 1});
+    }
+    return result;
+}
+
+}// namespace rdar
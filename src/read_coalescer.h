@@ -0,0 +1,35 @@
+#pragma once
+#include "span.h"
+#include <cstdint>
+#include <vector>
+
+namespace rdar {
+
+struct byte_range {
+    std::uint64_t begin;
+    std::uint64_t end;
+};
+
+// One large read covering the input ranges [first, last).
+struct coalesced_read {
+    std::uint64_t begin;
+    std::uint64_t end;
+    std::size_t first;
+    std::size_t last;
+};
+
+// Merges ranges that are adjacent or separated by at most max_gap bytes into
+// reads of at most max_size bytes. A single range larger than max_size still
+// becomes one read of its own.
+class read_coalescer {
+    std::uint64_t m_max_gap;
+    std::uint64_t m_max_size;
+
+public:
+    read_coalescer(std::uint64_t max_gap, std::uint64_t max_size);
+
+    // Ranges must be sorted by their beginning.
+    [[nodiscard]] std::vector<coalesced_read> coalesce(span<const byte_range> ranges) const;
+};
+
+}// namespace rdar
@@ -2,18 +2,35 @@
 
 namespace rdar {
 
-reader::reader(std::istream &stream) : m_stream(stream) {
+reader::reader(byte_span data) : m_data(data) {
+}
+
+void reader::require(std::size_t size) const {
+    if (size > m_data.size() - m_pos) {
+        throw std::runtime_error("unexpected end of archive");
+    }
 }
 
 void reader::seek(std::uint64_t offset) {
-    m_stream.seekg(static_cast<std::size_t>(offset), std::ios::beg);
+    if (offset > m_data.size()) {
+        throw std::runtime_error("seek past end of archive");
+    }
+    m_pos = static_cast<std::size_t>(offset);
+}
+
+std::size_t reader::remaining() const {
+    return m_data.size() - m_pos;
 }
 
 void reader::write_to(std::ostream &out, std::size_t size) {
-    auto buff = new char[size];
-    m_stream.read(buff, size);
-    out.write(buff, size);
-    delete [] buff;
+    out.write(read_span(size).data(), static_cast<std::streamsize>(size));
 }
 
+byte_span reader::read_span(std::size_t size) {
+    require(size);
+    auto result = m_data.subspan(m_pos, size);
+    m_pos += size;
+    return result;
 }
+
+}// namespace rdar
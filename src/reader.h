@@ -1,34 +1,53 @@
 #pragma once
+#include "span.h"
 #include <array>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
-#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
 
 namespace rdar {
 
 class reader {
-    std::istream &m_stream;
+    byte_span m_data;
+    std::size_t m_pos{};
+
 public:
-    explicit reader(std::istream &stream);
+    explicit reader(byte_span data);
 
     void seek(std::uint64_t offset);
+    [[nodiscard]] std::size_t remaining() const;
     void write_to(std::ostream &out, std::size_t size);
+    [[nodiscard]] byte_span read_span(std::size_t size);
 
     template <typename T> [[nodiscard]] T read();
     template <typename T, std::size_t S> void read_n(std::array<T, S> &arr);
+
+private:
+    void require(std::size_t size) const;
 };
 
+// Fields are stored little-endian regardless of the host byte order.
 template <typename T> T reader::read() {
-    T result;
-    m_stream.read(reinterpret_cast<char *>(&result), sizeof(T));
-    return result;
+    static_assert(std::is_integral_v<T>, "reader::read only decodes integers");
+    using unsigned_type = std::make_unsigned_t<T>;
+
+    require(sizeof(T));
+    auto bytes = reinterpret_cast<const unsigned char *>(m_data.data() + m_pos);
+    unsigned_type result = 0;
+    for (std::size_t i = 0; i < sizeof(T); ++i) {
+        result |= static_cast<unsigned_type>(static_cast<unsigned_type>(bytes[i]) << (8 * i));
+    }
+    m_pos += sizeof(T);
+    return static_cast<T>(result);
 }
 
 template <typename T, std::size_t S> void reader::read_n(std::array<T, S> &arr) {
-    std::generate_n(arr.begin(), S, [this](){
-      T result;
-      m_stream.read(reinterpret_cast<char *>(&result), sizeof(T));
-      return result;
-    });
+    static_assert(sizeof(T) == 1, "reader::read_n only copies byte arrays");
+    require(sizeof(T) * S);
+    std::memcpy(arr.data(), m_data.data() + m_pos, sizeof(T) * S);
+    m_pos += sizeof(T) * S;
 }
 
-}
+}// namespace rdar
@@ -0,0 +1,64 @@
+#include "segment_cache.h"
+
+namespace rdar {
+
+segment_cache::segment_cache(std::size_t budget) : m_budget(budget) {
+}
+
+segment_cache::buffer segment_cache::find(std::size_t index) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto at = m_entries.find(index);
+    if (at == m_entries.end()) {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    m_order.splice(m_order.begin(), m_order, at->second);
+    return at->second->second;
+}
+
+void segment_cache::insert(std::size_t index, buffer data) {
+    if (data == nullptr || data->size() > m_budget) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto at = m_entries.find(index);
+    if (at != m_entries.end()) {
+        // Another thread decoded the same segment in the meantime.
+        m_order.splice(m_order.begin(), m_order, at->second);
+        return;
+    }
+    m_size += data->size();
+    m_order.emplace_front(index, std::move(data));
+    m_entries.emplace(index, m_order.begin());
+    evict();
+}
+
+void segment_cache::evict() {
+    while (m_size > m_budget) {
+        auto &last = m_order.back();
+        m_size -= last.second->size();
+        m_entries.erase(last.first);
+        m_order.pop_back();
+    }
+}
+
+std::size_t segment_cache::budget() const {
+    return m_budget;
+}
+
+std::size_t segment_cache::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_size;
+}
+
+std::uint64_t segment_cache::hits() const {
+    return m_hits.load(std::memory_order_relaxed);
+}
+
+std::uint64_t segment_cache::misses() const {
+    return m_misses.load(std::memory_order_relaxed);
+}
+
+}// namespace rdar
@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace rdar {
+
+// Decoded segments keyed by segment index, shared between threads. Once the
+// decoded bytes exceed the budget the least recently used segments are
+// dropped; buffers still held by callers stay valid.
+class segment_cache {
+public:
+    using buffer = std::shared_ptr<const std::string>;
+
+private:
+    using entry = std::pair<std::size_t, buffer>;
+
+    std::size_t m_budget;
+    std::size_t m_size = 0;
+    std::list<entry> m_order;
+    std::unordered_map<std::size_t, std::list<entry>::iterator> m_entries;
+    mutable std::mutex m_mutex;
+    std::atomic<std::uint64_t> m_hits{0};
+    std::atomic<std::uint64_t> m_misses{0};
+
+public:
+    explicit segment_cache(std::size_t budget);
+
+    segment_cache(const segment_cache &) = delete;
+    segment_cache &operator=(const segment_cache &) = delete;
+
+    // Returns nullptr on a miss.
+    [[nodiscard]] buffer find(std::size_t index);
+    // Segments larger than the whole budget are not kept.
+    void insert(std::size_t index, buffer data);
+
+    [[nodiscard]] std::size_t budget() const;
+    // Decoded bytes currently held.
+    [[nodiscard]] std::size_t size() const;
+    [[nodiscard]] std::uint64_t hits() const;
+    [[nodiscard]] std::uint64_t misses() const;
+
+private:
+    void evict();
+};
+
+}// namespace rdar
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace rdar {
+
+template <typename T>
+class span {
+    T *m_data{};
+    std::size_t m_size{};
+
+public:
+    constexpr span() = default;
+    constexpr span(T *data, std::size_t size) : m_data(data), m_size(size) {}
+
+    template <typename C, typename = std::enable_if_t<std::is_convertible_v<decltype(std::declval<C &>().data()), T *>>>
+    constexpr span(C &container) : m_data(container.data()), m_size(container.size()) {}
+
+    template <typename C, typename = std::enable_if_t<std::is_convertible_v<decltype(std::declval<const C &>().data()), T *>>>
+    constexpr span(const C &container) : m_data(container.data()), m_size(container.size()) {}
+
+    [[nodiscard]] constexpr T *data() const { return m_data; }
+    [[nodiscard]] constexpr std::size_t size() const { return m_size; }
+    [[nodiscard]] constexpr bool empty() const { return m_size == 0; }
+
+    [[nodiscard]] constexpr T *begin() const { return m_data; }
+    [[nodiscard]] constexpr T *end() const { return m_data + m_size; }
+
+    [[nodiscard]] constexpr T &operator[](std::size_t i) const { return m_data[i]; }
+
+    [[nodiscard]] constexpr span subspan(std::size_t offset, std::size_t count) const {
+        return span(m_data + offset, count);
+    }
+};
+
+using byte_span = span<const char>;
+
+}// namespace rdar
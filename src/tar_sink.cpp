@@ -0,0 +1,258 @@
+#include "tar_sink.h"
+#include "util.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <fmt/core.h>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace rdar {
+
+constexpr std::size_t g_tar_block_size = 512;
+constexpr std::size_t g_tar_buffer_size = 4 * 1024 * 1024;
+// Files at least this large are written around the buffer.
+constexpr std::size_t g_tar_direct_min_size = 256 * 1024;
+// The largest size an 11-digit octal ustar field holds.
+constexpr std::uint64_t g_ustar_max_size = 077777777777;
+constexpr std::size_t g_ustar_name_size = 100;
+constexpr std::size_t g_ustar_prefix_size = 155;
+
+namespace {
+
+struct ustar_header {
+    std::array<char, g_tar_block_size> block{};
+
+    void put(std::size_t offset, std::size_t size, const std::string &value) {
+        std::memcpy(block.data() + offset, value.data(), std::min(size, value.size()));
+    }
+
+    void put_octal(std::size_t offset, std::size_t size, std::uint64_t value) {
+        put(offset, size, fmt::format("{:0{}o}", value, size - 1));
+    }
+
+    void seal() {
+        std::memset(block.data() + 148, ' ', 8);
+        std::uint32_t sum = 0;
+        for (auto c : block) {
+            sum += static_cast<unsigned char>(c);
+        }
+        put(148, 8, fmt::format("{:06o}", sum));
+        block[155] = ' ';
+    }
+};
+
+// Splits a path into the ustar prefix and name fields, at a slash.
+bool split_ustar_path(const std::string &path, std::string &prefix, std::string &name) {
+    if (path.size() <= g_ustar_name_size) {
+        prefix.clear();
+        name = path;
+        return true;
+    }
+    auto at = path.find('/', path.size() - g_ustar_name_size - 1);
+    if (at == std::string::npos || at > g_ustar_prefix_size || at + 1 == path.size()) {
+        return false;
+    }
+    prefix = path.substr(0, at);
+    name = path.substr(at + 1);
+    return true;
+}
+
+// A pax record is prefixed with its own length in decimal.
+std::string pax_record(const std::string &key, const std::string &value) {
+    auto body = " " + key + "=" + value + "\n";
+    auto length = body.size() + 1;
+    while (std::to_string(length).size() + body.size() != length) {
+        ++length;
+    }
+    return std::to_string(length) + body;
+}
+
+}// namespace
+
+tar_sink::tar_sink(const std::string &path) : m_mtime(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count())) {
+    if (path == "-") {
+#ifdef _WIN32
+        m_fd = _fileno(stdout);
+        _setmode(m_fd, _O_BINARY);
+#else
+        m_fd = STDOUT_FILENO;
+#endif
+    } else {
+#ifdef _WIN32
+        m_fd = ::_open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+        m_owns_fd = true;
+    }
+    if (m_fd < 0) {
+        throw std::runtime_error("could not open tar file");
+    }
+    m_buffer.reserve(g_tar_buffer_size);
+}
+
+tar_sink::~tar_sink() {
+    try {
+        finish();
+    } catch (std::runtime_error &e) {
+        fmt::print(stderr, "{}\n", e.what());
+    }
+    if (m_owns_fd) {
+#ifdef _WIN32
+        ::_close(m_fd);
+#else
+        ::close(m_fd);
+#endif
+    }
+}
+
+bool tar_sink::write_file(std::string path, span<const byte_span> parts) {
+    std::uint64_t size = 0;
+    for (auto &part : parts) {
+        size += part.size();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    write_header(path, size);
+    for (auto &part : parts) {
+        append(part.data(), part.size());
+    }
+    pad(size);
+    return true;
+}
+
+bool tar_sink::write_file(std::string path, const mapped_file &source, span<const byte_span> parts) {
+    std::uint64_t size = 0;
+    for (auto &part : parts) {
+        size += part.size();
+    }
+    if (size < g_tar_direct_min_size) {
+        return write_file(std::move(path), parts);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    write_header(path, size);
+    drain();
+    auto base = source.data().data();
+    for (auto &part : parts) {
+        if (!source.write_to(m_fd, static_cast<std::uint64_t>(part.data() - base), part.size())) {
+            throw std::runtime_error("could not write tar stream");
+        }
+    }
+    pad(size);
+    return true;
+}
+
+bool tar_sink::link_file(std::string path, const std::string &target, link_kind) {
+    auto link = target;
+    std::replace(link.begin(), link.end(), '\\', '/');
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    write_header(path, 0, '1', link);
+    return true;
+}
+
+void tar_sink::flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    drain();
+}
+
+void tar_sink::finish() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_finished) {
+        return;
+    }
+    m_finished = true;
+    std::array<char, 2 * g_tar_block_size> end{};
+    append(end.data(), end.size());
+    drain();
+}
+
+void tar_sink::write_header(const std::string &path, std::uint64_t size, char type, const std::string &link) {
+    if (m_finished) {
+        throw std::runtime_error("tar stream already finished");
+    }
+
+    auto name = path;
+    std::replace(name.begin(), name.end(), '\\', '/');
+
+    std::string prefix;
+    std::string short_name;
+    std::string records;
+    if (!split_ustar_path(name, prefix, short_name)) {
+        records += pax_record("path", name);
+        short_name = name.substr(name.size() - g_ustar_name_size);
+        prefix.clear();
+    }
+    if (size > g_ustar_max_size) {
+        records += pax_record("size", std::to_string(size));
+    }
+    if (link.size() > g_ustar_name_size) {
+        records += pax_record("linkpath", link);
+    }
+    if (!records.empty()) {
+        write_entry_header({}, "PaxHeader/" + short_name.substr(0, g_ustar_name_size - 10), records.size(), 'x');
+        append(records.data(), records.size());
+        pad(records.size());
+    }
+
+    write_entry_header(prefix, short_name, std::min(size, g_ustar_max_size), type, link);
+}
+
+void tar_sink::write_entry_header(const std::string &prefix, const std::string &name, std::uint64_t size, char type, const std::string &link) {
+    ustar_header header;
+    header.put(0, g_ustar_name_size, name);
+    header.put_octal(100, 8, 0644);
+    header.put_octal(108, 8, 0);
+    header.put_octal(116, 8, 0);
+    header.put_octal(124, 12, size);
+    header.put_octal(136, 12, m_mtime);
+    header.block[156] = type;
+    header.put(157, g_ustar_name_size, link);
+    header.put(257, 8, std::string("ustar\0" "00", 8));
+    header.put(345, g_ustar_prefix_size, prefix);
+    header.seal();
+    append(header.block.data(), header.block.size());
+}
+
+void tar_sink::append(const char *data, std::size_t size) {
+    if (m_buffer.size() + size > g_tar_buffer_size) {
+        drain();
+    }
+    if (size >= g_tar_buffer_size) {
+        if (!write_all(m_fd, byte_span(data, size))) {
+            throw std::runtime_error("could not write tar stream");
+        }
+        return;
+    }
+    m_buffer.insert(m_buffer.end(), data, data + size);
+}
+
+void tar_sink::pad(std::uint64_t size) {
+    static const std::array<char, g_tar_block_size> zeros{};
+    auto rest = size % g_tar_block_size;
+    if (rest != 0) {
+        append(zeros.data(), g_tar_block_size - rest);
+    }
+}
+
+void tar_sink::drain() {
+    if (m_buffer.empty()) {
+        return;
+    }
+    if (!write_all(m_fd, byte_span(m_buffer.data(), m_buffer.size()))) {
+        throw std::runtime_error("could not write tar stream");
+    }
+    m_buffer.clear();
+}
+
+}// namespace rdar
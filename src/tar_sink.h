@@ -0,0 +1,47 @@
+#pragma once
+#include "file_sink.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rdar {
+
+// Streams extracted files as a POSIX tar archive, to a file or to stdout.
+// Names that do not fit a ustar header and files of 8 GiB and more get a pax
+// extended header. Small files are gathered into large sequential writes;
+// large uncompressed ones are moved by the kernel.
+class tar_sink : public file_sink {
+    int m_fd = -1;
+    bool m_owns_fd = false;
+    bool m_finished = false;
+    std::uint64_t m_mtime;
+    std::vector<char> m_buffer;
+    std::mutex m_mutex;
+
+public:
+    // A path of "-" streams to stdout.
+    explicit tar_sink(const std::string &path);
+    ~tar_sink() override;
+
+    tar_sink(const tar_sink &) = delete;
+    tar_sink &operator=(const tar_sink &) = delete;
+
+    bool write_file(std::string path, span<const byte_span> parts) override;
+    bool write_file(std::string path, const mapped_file &source, span<const byte_span> parts) override;
+    using file_sink::write_file;
+    // Writes a hard link entry, whatever the kind asked for.
+    bool link_file(std::string path, const std::string &target, link_kind kind) override;
+    void flush() override;
+    // Writes the end-of-archive marker. Further files are rejected.
+    void finish();
+
+private:
+    void write_header(const std::string &path, std::uint64_t size, char type = '0', const std::string &link = {});
+    void write_entry_header(const std::string &prefix, const std::string &name, std::uint64_t size, char type, const std::string &link = {});
+    void append(const char *data, std::size_t size);
+    void pad(std::uint64_t size);
+    void drain();
+};
+
+}// namespace rdar
@@ -0,0 +1,152 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace rdar {
+
+namespace {
+
+struct worker_queue {
+    std::mutex mutex;
+    std::deque<std::size_t> items;
+};
+
+std::optional<std::size_t> pop_front(worker_queue &queue) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.items.empty()) {
+        return std::nullopt;
+    }
+    auto item = queue.items.front();
+    queue.items.pop_front();
+    return item;
+}
+
+std::optional<std::size_t> steal(std::vector<worker_queue> &queues, std::size_t thief) {
+    for (std::size_t i = 1; i < queues.size(); ++i) {
+        auto &victim = queues[(thief + i) % queues.size()];
+
+        std::vector<std::size_t> stolen;
+        {
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            auto count = (victim.items.size() + 1) / 2;
+            stolen.assign(victim.items.end() - count, victim.items.end());
+            victim.items.erase(victim.items.end() - count, victim.items.end());
+        }
+        if (stolen.empty()) {
+            continue;
+        }
+
+        auto &own = queues[thief];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        own.items.insert(own.items.end(), stolen.begin() + 1, stolen.end());
+        return stolen.front();
+    }
+    return std::nullopt;
+}
+
+}// namespace
+
+thread_pool::thread_pool(std::size_t threads) : m_threads(std::max<std::size_t>(threads, 1)) {
+}
+
+std::size_t thread_pool::size() const {
+    return m_threads;
+}
+
+void thread_pool::run(span<const std::uint64_t> costs, const task &fn) const {
+    if (m_threads == 1 || costs.size() < 2) {
+        for (std::size_t i = 0; i < costs.size(); ++i) {
+            fn(0, i);
+        }
+        return;
+    }
+
+    auto workers = std::min(m_threads, costs.size());
+    std::vector<worker_queue> queues(workers);
+
+    std::uint64_t total_cost = 0;
+    for (auto cost : costs) {
+        total_cost += cost;
+    }
+    std::uint64_t assigned_cost = 0;
+    std::size_t worker = 0;
+    for (std::size_t i = 0; i < costs.size(); ++i) {
+        while (worker + 1 < workers && assigned_cost * workers >= total_cost * (worker + 1)) {
+            ++worker;
+        }
+        queues[worker].items.push_back(i);
+        assigned_cost += costs[i];
+    }
+
+    run_workers(workers, [&](std::size_t id) {
+        auto item = pop_front(queues[id]);
+        if (!item) {
+            item = steal(queues, id);
+        }
+        if (!item) {
+            return false;
+        }
+        fn(id, *item);
+        return true;
+    });
+}
+
+void thread_pool::run_in_order(std::size_t count, const task &fn) const {
+    if (m_threads == 1 || count < 2) {
+        for (std::size_t i = 0; i < count; ++i) {
+            fn(0, i);
+        }
+        return;
+    }
+
+    std::atomic<std::size_t> next{0};
+    run_workers(std::min(m_threads, count), [&](std::size_t id) {
+        auto item = next.fetch_add(1);
+        if (item >= count) {
+            return false;
+        }
+        fn(id, item);
+        return true;
+    });
+}
+
+void thread_pool::run_workers(std::size_t workers, const std::function<bool(std::size_t)> &step) const {
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto work = [&](std::size_t id) {
+        try {
+            while (!failed && step(id)) {
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+            failed = true;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+    for (std::size_t id = 1; id < workers; ++id) {
+        threads.emplace_back(work, id);
+    }
+    work(0);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+}// namespace rdar
@@ -0,0 +1,34 @@
+#pragma once
+#include "span.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace rdar {
+
+// Runs a batch of independent items on a fixed number of threads.
+class thread_pool {
+    std::size_t m_threads;
+
+public:
+    // Called with the worker number and the item index.
+    using task = std::function<void(std::size_t, std::size_t)>;
+
+    explicit thread_pool(std::size_t threads);
+
+    [[nodiscard]] std::size_t size() const;
+
+    // Runs task for every item in [0, costs.size()). Every worker starts on a
+    // contiguous share of the items of roughly equal cost and, once it runs
+    // dry, steals the back half of another worker's remaining share. The first
+    // exception thrown by a task stops the remaining work and is rethrown here.
+    void run(span<const std::uint64_t> costs, const task &fn) const;
+    // Like run, but items are handed out one at a time in ascending order, so
+    // the items in progress always form a narrow window moving front to back.
+    void run_in_order(std::size_t count, const task &fn) const;
+
+private:
+    void run_workers(std::size_t workers, const std::function<bool(std::size_t)> &step) const;
+};
+
+}// namespace rdar
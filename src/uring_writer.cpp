@@ -0,0 +1,412 @@
+#include "uring_writer.h"
+#include <algorithm>
+#include <fmt/core.h>
+#include <utility>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define RDAR_HAS_IO_URING 1
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace rdar {
+
+// Single writes are kept below the kernel's per-call limit.
+constexpr std::size_t g_uring_max_write = 1u << 30;
+// Files queued ahead of the ring, per slot, before writers are held back.
+constexpr std::size_t g_uring_queue_factor = 4;
+
+// Completions of operations whose failure does not fail the file carry this
+// bit in their user data; pending files are at least 8-byte aligned.
+constexpr std::uint64_t g_uring_optional_op = 1;
+
+struct uring_writer::pending_file {
+    int dir_fd = -1;
+    std::string path;
+    std::string label;
+    bool preallocate = false;
+    std::string owned;
+    std::vector<byte_span> parts;
+    std::uint32_t slot = 0;
+    std::size_t ops_left = 0;
+    int error = 0;
+    std::uint64_t size = 0;
+    std::uint64_t written = 0;
+};
+
+#ifdef RDAR_HAS_IO_URING
+
+struct uring_writer::ring {
+    int fd = -1;
+    unsigned sq_entries = 0;
+    unsigned cq_entries = 0;
+
+    void *sq_map = nullptr;
+    std::size_t sq_map_size = 0;
+    void *cq_map = nullptr;
+    std::size_t cq_map_size = 0;
+    io_uring_sqe *sqes = nullptr;
+    std::size_t sqes_size = 0;
+
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+
+    unsigned queued = 0;
+
+    ~ring() {
+        if (sqes != nullptr) {
+            ::munmap(sqes, sqes_size);
+        }
+        if (cq_map != nullptr && cq_map != sq_map) {
+            ::munmap(cq_map, cq_map_size);
+        }
+        if (sq_map != nullptr) {
+            ::munmap(sq_map, sq_map_size);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    io_uring_sqe &next_sqe() {
+        auto index = (*sq_tail + queued) & *sq_mask;
+        sq_array[index] = index;
+        ++queued;
+
+        auto &sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        return sqe;
+    }
+
+    void enter(bool wait) {
+        __atomic_store_n(sq_tail, *sq_tail + queued, __ATOMIC_RELEASE);
+        auto to_submit = queued;
+        queued = 0;
+        while (::syscall(__NR_io_uring_enter, fd, to_submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0) < 0 && errno == EINTR) {
+        }
+    }
+};
+
+std::unique_ptr<uring_writer> uring_writer::create(unsigned depth) {
+    auto r = std::make_unique<ring>();
+
+    io_uring_params params{};
+    r->fd = static_cast<int>(::syscall(__NR_io_uring_setup, depth, &params));
+    if (r->fd < 0) {
+        return nullptr;
+    }
+    r->sq_entries = params.sq_entries;
+    r->cq_entries = params.cq_entries;
+
+    r->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        r->sq_map_size = std::max(r->sq_map_size, r->cq_map_size);
+    }
+
+    r->sq_map = ::mmap(nullptr, r->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) {
+        r->sq_map = nullptr;
+        return nullptr;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_map = r->sq_map;
+    } else {
+        r->cq_map = ::mmap(nullptr, r->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED) {
+            r->cq_map = nullptr;
+            return nullptr;
+        }
+    }
+    r->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    auto sqes = ::mmap(nullptr, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return nullptr;
+    }
+    r->sqes = static_cast<io_uring_sqe *>(sqes);
+
+    auto sq = static_cast<char *>(r->sq_map);
+    r->sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    r->sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    r->sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    auto cq = static_cast<char *>(r->cq_map);
+    r->cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    r->cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    r->cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    r->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // Files are opened straight into a table of direct descriptors, so the
+    // writes and the close can be linked to the open without its result.
+    io_uring_rsrc_register files{};
+    files.nr = params.sq_entries;
+    files.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (::syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_FILES2, &files, sizeof(files)) < 0) {
+        return nullptr;
+    }
+
+    return std::make_unique<uring_writer>(std::move(r));
+}
+
+uring_writer::uring_writer(std::unique_ptr<ring> r) : m_ring(std::move(r)) {
+    auto slots = m_ring->sq_entries;
+    m_free_slots.reserve(slots);
+    for (auto slot = slots; slot-- > 0;) {
+        m_free_slots.push_back(slot);
+    }
+    m_thread = std::thread([this] { run(); });
+}
+
+bool uring_writer::fits(span<const byte_span> parts) const {
+    std::size_t writes = 0;
+    for (auto &part : parts) {
+        writes += (part.size() + g_uring_max_write - 1) / g_uring_max_write;
+    }
+    // The open, the fallocate, the writes and the close have to be submitted
+    // together.
+    return writes + 3 <= m_ring->sq_entries / 2;
+}
+
+bool uring_writer::write_file(int dir_fd, const std::string &name, const std::string &label, span<const byte_span> parts, bool preallocate) {
+    if (!fits(parts)) {
+        return false;
+    }
+    auto file = new pending_file;
+    file->dir_fd = dir_fd;
+    file->path = name;
+    file->label = label;
+    file->preallocate = preallocate;
+    file->parts.assign(parts.begin(), parts.end());
+    enqueue(file);
+    return true;
+}
+
+bool uring_writer::write_file(int dir_fd, const std::string &name, const std::string &label, std::string &&content, bool preallocate) {
+    byte_span part(content.data(), content.size());
+    if (!fits(span<const byte_span>(&part, 1))) {
+        return false;
+    }
+    auto file = new pending_file;
+    file->dir_fd = dir_fd;
+    file->path = name;
+    file->label = label;
+    file->preallocate = preallocate;
+    file->owned = std::move(content);
+    file->parts.emplace_back(file->owned.data(), file->owned.size());
+    enqueue(file);
+    return true;
+}
+
+void uring_writer::enqueue(pending_file *file) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_work_done.wait(lock, [this] {
+        return m_queue.size() < m_ring->sq_entries * g_uring_queue_factor;
+    });
+    m_queue.push_back(file);
+    ++m_outstanding;
+    m_work_ready.notify_one();
+}
+
+void uring_writer::run() {
+    for (;;) {
+        std::vector<pending_file *> batch;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_work_ready.wait(lock, [this] {
+                return m_stopping || !m_queue.empty() || m_in_flight != 0;
+            });
+            if (m_stopping && m_queue.empty() && m_in_flight == 0) {
+                return;
+            }
+
+            // A chain never needs more than half of the ring, so keeping that
+            // much room guarantees every completion fits the completion queue.
+            auto slots = m_free_slots.size();
+            while (!m_queue.empty() && slots != 0 && m_in_flight + m_ring->queued + m_ring->sq_entries / 2 <= m_ring->cq_entries && m_ring->queued + m_ring->sq_entries / 2 <= m_ring->sq_entries) {
+                submit(m_queue.front());
+                m_queue.pop_front();
+                --slots;
+            }
+            if (m_ring->queued != 0) {
+                m_work_done.notify_all();
+            }
+        }
+
+        m_in_flight += m_ring->queued;
+        auto progressed = m_ring->queued != 0;
+        m_ring->enter(!progressed);
+        reap();
+    }
+}
+
+void uring_writer::submit(pending_file *file) {
+    auto slot = m_free_slots.back();
+    m_free_slots.pop_back();
+    file->slot = slot;
+    auto user_data = reinterpret_cast<std::uint64_t>(file);
+    auto first = m_ring->queued;
+
+    // Hard links keep the close in the chain even when a write fails, so the
+    // slot is always released.
+    auto &open = m_ring->next_sqe();
+    open.opcode = IORING_OP_OPENAT;
+    open.flags = IOSQE_IO_HARDLINK;
+    open.fd = file->dir_fd;
+    open.addr = reinterpret_cast<std::uint64_t>(file->path.c_str());
+    open.len = 0644;
+    open.open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+    open.file_index = slot + 1;
+    open.user_data = user_data;
+
+    std::uint64_t size = 0;
+    for (auto &part : file->parts) {
+        size += part.size();
+    }
+    if (file->preallocate && size != 0) {
+        // Reserving the blocks is only a hint; file systems without it still
+        // get the file.
+        auto &fallocate = m_ring->next_sqe();
+        fallocate.opcode = IORING_OP_FALLOCATE;
+        fallocate.flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+        fallocate.fd = static_cast<int>(slot);
+        fallocate.off = 0;
+        fallocate.addr = size;
+        fallocate.len = FALLOC_FL_KEEP_SIZE;
+        fallocate.user_data = user_data | g_uring_optional_op;
+    }
+
+    for (auto &part : file->parts) {
+        for (std::size_t at = 0; at < part.size(); at += g_uring_max_write) {
+            auto size = std::min(g_uring_max_write, part.size() - at);
+            auto &write = m_ring->next_sqe();
+            write.opcode = IORING_OP_WRITE;
+            write.flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+            write.fd = static_cast<int>(slot);
+            write.addr = reinterpret_cast<std::uint64_t>(part.data() + at);
+            write.len = static_cast<std::uint32_t>(size);
+            write.off = file->size;
+            write.user_data = user_data;
+            file->size += size;
+        }
+    }
+
+    auto &close = m_ring->next_sqe();
+    close.opcode = IORING_OP_CLOSE;
+    close.file_index = slot + 1;
+    close.user_data = user_data;
+
+    file->ops_left = m_ring->queued - first;
+}
+
+void uring_writer::reap() {
+    std::vector<pending_file *> completed;
+    auto head = *m_ring->cq_head;
+    auto tail = __atomic_load_n(m_ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        auto &cqe = m_ring->cqes[head & *m_ring->cq_mask];
+        auto file = reinterpret_cast<pending_file *>(cqe.user_data & ~g_uring_optional_op);
+        auto optional = (cqe.user_data & g_uring_optional_op) != 0;
+        if (cqe.res < 0 && !optional && file->error == 0) {
+            file->error = -cqe.res;
+        }
+        // Only the writes complete with a positive result.
+        if (cqe.res > 0 && !optional) {
+            file->written += static_cast<std::uint64_t>(cqe.res);
+        }
+        --m_in_flight;
+        if (--file->ops_left == 0) {
+            completed.push_back(file);
+        }
+    }
+    __atomic_store_n(m_ring->cq_head, head, __ATOMIC_RELEASE);
+
+    if (completed.empty()) {
+        return;
+    }
+    for (auto file : completed) {
+        if (file->error == 0 && file->written != file->size) {
+            file->error = EIO;
+        }
+        if (file->error != 0) {
+            fmt::print(stderr, "could not write file: {}: {}\n", file->label, std::strerror(file->error));
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto file : completed) {
+        if (file->error != 0) {
+            m_failed.push_back(std::move(file->label));
+        }
+        m_free_slots.push_back(file->slot);
+        delete file;
+    }
+    m_outstanding -= completed.size();
+    m_work_done.notify_all();
+}
+
+#else
+
+struct uring_writer::ring {
+    unsigned sq_entries = 0;
+};
+
+std::unique_ptr<uring_writer> uring_writer::create(unsigned) {
+    return nullptr;
+}
+
+uring_writer::uring_writer(std::unique_ptr<ring> r) : m_ring(std::move(r)) {
+}
+
+bool uring_writer::fits(span<const byte_span>) const {
+    return false;
+}
+
+bool uring_writer::write_file(int, const std::string &, const std::string &, span<const byte_span>, bool) {
+    return false;
+}
+
+bool uring_writer::write_file(int, const std::string &, const std::string &, std::string &&, bool) {
+    return false;
+}
+
+void uring_writer::enqueue(pending_file *) {
+}
+
+void uring_writer::run() {
+}
+
+void uring_writer::submit(pending_file *) {
+}
+
+void uring_writer::reap() {
+}
+
+#endif
+
+std::vector<std::string> uring_writer::flush() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_work_done.wait(lock, [this] { return m_outstanding == 0; });
+    return std::exchange(m_failed, {});
+}
+
+uring_writer::~uring_writer() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_work_ready.notify_one();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+}// namespace rdar
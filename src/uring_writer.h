@@ -0,0 +1,71 @@
+#pragma once
+#include "span.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rdar {
+
+// Writes whole output files through io_uring. Every file is queued as one
+// linked chain (openat into a direct descriptor slot, an optional fallocate,
+// its writes, close), and
+// many chains are kept in flight at once, so creating a file costs no syscall
+// round-trip of its own. The ring is driven by a dedicated thread, as
+// requests in flight are cancelled when the thread that submitted them exits.
+// Only available on Linux kernels with io_uring and sparse direct descriptor
+// tables (5.19+).
+class uring_writer {
+    struct pending_file;
+    struct ring;
+
+    std::unique_ptr<ring> m_ring;
+    std::vector<std::uint32_t> m_free_slots;
+    std::size_t m_in_flight = 0;
+
+    std::mutex m_mutex;
+    std::condition_variable m_work_ready;
+    std::condition_variable m_work_done;
+    std::deque<pending_file *> m_queue;
+    std::size_t m_outstanding = 0;
+    // Labels of the files that failed since the last flush.
+    std::vector<std::string> m_failed;
+    bool m_stopping = false;
+    std::thread m_thread;
+
+public:
+    // Returns nullptr if io_uring cannot be used on this system.
+    [[nodiscard]] static std::unique_ptr<uring_writer> create(unsigned depth);
+
+    explicit uring_writer(std::unique_ptr<ring> r);
+    ~uring_writer();
+
+    uring_writer(const uring_writer &) = delete;
+    uring_writer &operator=(const uring_writer &) = delete;
+
+    // Queues a file, opened relative to dir_fd, made of the given parts,
+    // which must stay valid until the file completes. The label names the
+    // file in reports of its failure. With preallocate its blocks are
+    // reserved before the writes. Returns false, queuing nothing, if the
+    // file needs more writes than fit in a single chain.
+    [[nodiscard]] bool write_file(int dir_fd, const std::string &name, const std::string &label, span<const byte_span> parts, bool preallocate);
+    // Queues a file whose content is kept alive by the writer. The content is
+    // only moved from if the file is queued.
+    [[nodiscard]] bool write_file(int dir_fd, const std::string &name, const std::string &label, std::string &&content, bool preallocate);
+    // Waits for every queued file to complete, and returns the labels of
+    // those that could not be written since the last flush.
+    std::vector<std::string> flush();
+
+private:
+    [[nodiscard]] bool fits(span<const byte_span> parts) const;
+    void enqueue(pending_file *file);
+    void run();
+    void submit(pending_file *file);
+    void reap();
+};
+
+}// namespace rdar
@@ -1,23 +1,83 @@
 #include "util.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <filesystem>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <cerrno>
+#include <unistd.h>
+#endif
 
 namespace rdar {
 
-std::unordered_map<std::uint64_t, std::string> read_hashes(std::istream &stream) {
-    std::unordered_map<std::uint64_t, std::string> result;
-    std::string line;
+// Chunks below this size are not worth a thread of their own.
+constexpr std::size_t g_hashes_min_chunk = 1024 * 1024;
+
+namespace {
+
+using hash_name = std::pair<std::uint64_t, std::string_view>;
+
+void parse_hashes(std::string_view text, const std::function<bool(std::uint64_t)> &keep, std::vector<hash_name> &out) {
+    while (!text.empty()) {
+        auto end = text.find('\n');
+        auto line = text.substr(0, end);
+        text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
 
-    while(std::getline(stream, line)) {
         auto at = line.find(',');
-        if (at >= line.size()) {
+        if (at == std::string_view::npos) {
+            continue;
+        }
+        std::uint64_t hash = 0;
+        auto hash_part = line.substr(at + 1);
+        auto result = std::from_chars(hash_part.data(), hash_part.data() + hash_part.size(), hash);
+        if (result.ec != std::errc{} || (keep && !keep(hash))) {
             continue;
         }
-        auto name_part = line.substr(0, at);
-        auto hash_part = line.substr(at+1);
-        auto hash = std::strtoull(hash_part.c_str(), nullptr, 10);
+        out.emplace_back(hash, line.substr(0, at));
+    }
+}
+
+}// namespace
 
-        result[hash] = name_part;
+std::vector<std::pair<std::uint64_t, std::string_view>> read_hashes(byte_span data, std::size_t threads, const std::function<bool(std::uint64_t)> &keep) {
+    std::string_view text(data.data(), data.size());
+
+    // Chunks end after a line break, so no line is split between two.
+    auto chunk_count = std::max<std::size_t>(std::min(threads, text.size() / g_hashes_min_chunk), 1);
+    std::vector<std::string_view> chunks;
+    chunks.reserve(chunk_count);
+    std::size_t begin = 0;
+    for (std::size_t i = 1; i <= chunk_count && begin < text.size(); ++i) {
+        auto end = i == chunk_count ? text.size() : text.find('\n', std::max(begin, text.size() * i / chunk_count));
+        end = end == std::string_view::npos ? text.size() : std::min(end + 1, text.size());
+        chunks.push_back(text.substr(begin, end - begin));
+        begin = end;
     }
 
+    std::vector<std::vector<hash_name>> parsed(chunks.size());
+    thread_pool(chunks.size()).run_in_order(chunks.size(), [&chunks, &parsed, &keep](std::size_t, std::size_t i) {
+        if (!keep) {
+            parsed[i].reserve(chunks[i].size() / 64);
+        }
+        parse_hashes(chunks[i], keep, parsed[i]);
+    });
+
+    std::size_t count = 0;
+    for (auto &lines : parsed) {
+        count += lines.size();
+    }
+    std::vector<hash_name> result;
+    result.reserve(count);
+    for (auto &lines : parsed) {
+        result.insert(result.end(), lines.begin(), lines.end());
+    }
     return result;
 }
 
@@ -28,4 +88,119 @@ std::uint64_t win_filetime_to_unix_ts(std::uint64_t filetime) {
     return filetime / g_win_tick - g_epoch_diff;
 }
 
-}
\ No newline at end of file
+std::int64_t file_mtime(const std::string &path) {
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(path, ec);
+    if (ec) {
+        return 0;
+    }
+    return static_cast<std::int64_t>(time.time_since_epoch().count());
+}
+
+constexpr std::size_t g_fnv_lanes = 4;
+
+std::uint64_t fnv1a64(std::string_view str, std::uint64_t seed) {
+    auto hash = seed;
+    for (auto c : str) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= g_fnv_prime;
+    }
+    return hash;
+}
+
+void fnv1a64_many(std::uint64_t seed, span<const std::string_view> words, std::string_view suffix, span<std::uint64_t> out) {
+    auto step = [](std::uint64_t hash, unsigned char c) {
+        return (hash ^ c) * g_fnv_prime;
+    };
+
+    std::size_t first = 0;
+    for (; first + g_fnv_lanes <= words.size(); first += g_fnv_lanes) {
+        auto a = reinterpret_cast<const unsigned char *>(words[first].data());
+        auto b = reinterpret_cast<const unsigned char *>(words[first + 1].data());
+        auto c = reinterpret_cast<const unsigned char *>(words[first + 2].data());
+        auto d = reinterpret_cast<const unsigned char *>(words[first + 3].data());
+        auto common = std::min({words[first].size(), words[first + 1].size(), words[first + 2].size(), words[first + 3].size()});
+
+        // The lanes step through the bytes all their words have together,
+        // then each finishes its own word.
+        auto ha = seed;
+        auto hb = seed;
+        auto hc = seed;
+        auto hd = seed;
+        for (std::size_t at = 0; at < common; ++at) {
+            ha = step(ha, a[at]);
+            hb = step(hb, b[at]);
+            hc = step(hc, c[at]);
+            hd = step(hd, d[at]);
+        }
+        ha = fnv1a64(words[first].substr(common), ha);
+        hb = fnv1a64(words[first + 1].substr(common), hb);
+        hc = fnv1a64(words[first + 2].substr(common), hc);
+        hd = fnv1a64(words[first + 3].substr(common), hd);
+
+        for (auto byte : suffix) {
+            auto u = static_cast<unsigned char>(byte);
+            ha = step(ha, u);
+            hb = step(hb, u);
+            hc = step(hc, u);
+            hd = step(hd, u);
+        }
+        out[first] = ha;
+        out[first + 1] = hb;
+        out[first + 2] = hc;
+        out[first + 3] = hd;
+    }
+
+    for (; first < words.size(); ++first) {
+        out[first] = fnv1a64(suffix, fnv1a64(words[first], seed));
+    }
+}
+
+bool write_all(int fd, byte_span data) {
+    std::size_t written = 0;
+    while (written < data.size()) {
+        auto chunk = std::min<std::size_t>(data.size() - written, 1u << 30);
+#ifdef _WIN32
+        auto result = ::_write(fd, data.data() + written, static_cast<unsigned>(chunk));
+#else
+        auto result = ::write(fd, data.data() + written, chunk);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (result <= 0) {
+            return false;
+        }
+        written += static_cast<std::size_t>(result);
+    }
+    return true;
+}
+
+bool write_all_at(int fd, byte_span data, std::uint64_t position) {
+    std::size_t written = 0;
+    while (written < data.size()) {
+        auto chunk = std::min<std::size_t>(data.size() - written, 1u << 30);
+        auto at = position + written;
+#ifdef _WIN32
+        OVERLAPPED overlapped{};
+        overlapped.Offset = static_cast<DWORD>(at);
+        overlapped.OffsetHigh = static_cast<DWORD>(at >> 32);
+        DWORD result = 0;
+        if (!WriteFile(reinterpret_cast<HANDLE>(_get_osfhandle(fd)), data.data() + written, static_cast<DWORD>(chunk), &result, &overlapped)) {
+            return false;
+        }
+#else
+        auto result = ::pwrite(fd, data.data() + written, chunk, static_cast<off_t>(at));
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (result <= 0) {
+            return false;
+        }
+        written += static_cast<std::size_t>(result);
+    }
+    return true;
+}
+
+}
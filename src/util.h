@@ -1,12 +1,40 @@
 #pragma once
-#include <unordered_map>
+#include "span.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <string>
-#include <istream>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 namespace rdar {
 
-std::unordered_map<std::uint64_t, std::string> read_hashes(std::istream &stream);
+// Parses "name,hash" lines, split into chunks at line breaks that are parsed
+// on up to threads threads. Returns the names, as views into data, with their
+// hashes in list order. Lines without a decimal hash are skipped, and when
+// keep is set so are the hashes it rejects.
+std::vector<std::pair<std::uint64_t, std::string_view>> read_hashes(byte_span data, std::size_t threads = 1, const std::function<bool(std::uint64_t)> &keep = {});
 
 std::uint64_t win_filetime_to_unix_ts(std::uint64_t filetime);
 
+// The modification time of a file in file clock ticks, or 0 if it has none.
+std::int64_t file_mtime(const std::string &path);
+
+constexpr std::uint64_t g_fnv_offset_basis = 0xcbf29ce484222325;
+constexpr std::uint64_t g_fnv_prime = 0x100000001b3;
+
+// Hashes str, or with a seed continues the hash of what preceded it.
+std::uint64_t fnv1a64(std::string_view str, std::uint64_t seed = g_fnv_offset_basis);
+// Continues the hash seed over every word followed by suffix, into out. Words
+// are hashed four at a time in independent lanes, so their multiplications
+// overlap instead of each waiting on the one before.
+void fnv1a64_many(std::uint64_t seed, span<const std::string_view> words, std::string_view suffix, span<std::uint64_t> out);
+
+// Writes all of data to the descriptor. Returns false on a write error.
+bool write_all(int fd, byte_span data);
+// Writes all of data at a position of the file, leaving the file position
+// alone, so several threads may write to one descriptor.
+bool write_all_at(int fd, byte_span data, std::uint64_t position);
+
 }
\ No newline at end of file